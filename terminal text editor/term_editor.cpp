@@ -7,17 +7,35 @@
 #include<cctype>
 #include <cstdio>
 #include <termios.h>
+#include <poll.h>
+#include <signal.h>
 #include <unistd.h>
 #include <cstdlib>
 #include <cerrno>
 #include <sys/ioctl.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <string>
 #include <string.h>
 #include <vector>
 #include <stack>
 #include <iostream>
 #include <sstream>
+#include <memory>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include "columns.h"
+#include "line_scan.h"
+#include "highlight.h"
+#include "journal.h"
+#include "mapped_file.h"
+#include "piece_table.h"
+#include "regex_search.h"
+#include "search.h"
+#include "spell.h"
+#include "utf8.h"
 
 /*** defines **/
 
@@ -25,8 +43,9 @@
 
 #define CTRL_KEY(k) ((k) & 0x1f)
 
+// Keys below 0x110000 are the code points of typed characters.
 enum EditorKey {
-    ARROW_LEFT = 1000,
+    ARROW_LEFT = 0x110000,
     ARROW_RIGHT,
     ARROW_UP,
     ARROW_DOWN,
@@ -34,7 +53,8 @@ enum EditorKey {
     HOME_KEY,
     END_KEY,
     PAGE_UP,
-    PAGE_DOWN
+    PAGE_DOWN,
+    PASTE_START
 };
 
 /*** data ***/
@@ -47,8 +67,39 @@ public:
     virtual void Do(TextEditor*) = 0;
     virtual void Undo(TextEditor*) = 0;
     virtual ~IAction() = default;
+    static void* operator new(size_t);
+    static void operator delete(void*);
+    static size_t allocations;
 };
 
+// Actions are carved out of slabs of kActionSlab fixed-size slots and freed
+// ones go back to a free list, so the typing path reaches the heap only once
+// per slab while the history grows.
+const size_t kActionSlot = 64;
+const size_t kActionSlab = 256;
+void* free_actions = nullptr;
+
+size_t IAction::allocations = 0;
+
+void* IAction::operator new(size_t) {
+    if (!free_actions) {
+        char* slab = static_cast<char*>(::operator new(kActionSlab * kActionSlot));
+        ++allocations;
+        for (size_t i = kActionSlab; i-- > 0;) {
+            *reinterpret_cast<void**>(slab + i * kActionSlot) = free_actions;
+            free_actions = slab + i * kActionSlot;
+        }
+    }
+    void* slot = free_actions;
+    free_actions = *static_cast<void**>(slot);
+    return slot;
+}
+
+void IAction::operator delete(void* slot) {
+    *static_cast<void**>(slot) = free_actions;
+    free_actions = slot;
+}
+
 struct ActionHistory {
     std::stack<IAction*> for_undo;
     std::stack<IAction*> for_redo;
@@ -83,55 +134,163 @@ bool Cursor::operator!=(const Cursor& s) {
 
 Cursor cur;
 
+// A range of bytes of the text and what it is replaced with.
+struct Splice {
+    size_t offset;
+    size_t length;
+    const char* text;
+    size_t size;
+};
+
+// A text attribute switched on or off at a byte of the line being drawn.
+struct Mark {
+    size_t pos;
+    int sgr;
+};
+
 class TextEditor {
-    std::vector<std::string> text_;
+    PieceTable text_;
     size_t screenrows;
     size_t screencols;
     size_t rowoff;
     size_t coloff;
+    std::string filename;
+    std::string statusmsg;
+    std::string newline_;
+    std::string ending_;
+    bool was_empty_;
+    Journal journal;
+    Highlighter highlight_;
+    ColumnIndex columns_;
+    size_t rx_;
+    std::chrono::steady_clock::duration frame_interval_;
+    std::chrono::steady_clock::time_point last_frame_;
+    std::vector<std::string> shadow_;
+    std::vector<bool> dirty_;
+    bool welcome_;
+    std::string frame_;
+    std::string row_;
+    std::string window_;
+    std::string found_;
+    std::vector<Mark> marks_;
+    std::vector<Mark> matches_;
+    std::vector<Mark> misspelled_;
+    std::string status_;
+    bool show_frame_stats_;
+    std::chrono::steady_clock::duration frame_time_;
+    size_t frame_allocations_;
+    bool searching_;
+    std::string query_;
+    Cursor saved_;
+    size_t saved_rowoff_;
+    size_t saved_coloff_;
+    size_t origin_;
+    size_t match_;
+    bool placed_;
+    size_t scan_;
+    size_t stop_;
+    bool wrapped_;
+    bool regex_;
+    bool regex_ran_;
+    bool regex_bad_;
+    bool regex_scanning_;
+    size_t regex_at_;
+    RegexSearch regex_search_;
+    std::vector<RegexSearch::Match> regex_matches_;
+    bool replacing_;
+    std::string replacement_;
+    SpellChecker spell_;
+    std::vector<size_t> spelled_;
+    PieceTable::Snapshot spell_text_;
+    bool spell_batch_;
+    static const int kIdleTimeout = 100;
+    static const int kPollTimeout = 10;
+    static const size_t kSearchSlice = 1 << 22;
+    static const size_t kSpliceGap = 1 << 12;
+    static const size_t kSpliceBlock = 1 << 20;
+    size_t Offset();
+    void Insert(size_t, const char*, size_t);
+    void Erase(size_t, size_t);
+    void MarkDirty(size_t, bool);
 
 public:
     ActionHistory storage_;
     Cursor cur_;
     void EditorOpen(char*);
-    void EditorAppendRow(char*, size_t);
+    void EditorSave();
     void EditorScroll();
+    void EditorScrollRows(std::string&, size_t);
+    void EditorDrawRow(size_t, std::string&);
+    void EditorDrawCells(size_t, const ColumnIndex::Cells&, std::string&);
+    void EditorFindVisible(size_t, const ColumnIndex::Cells&);
+    void EditorRegexVisible(size_t, const ColumnIndex::Cells&);
+    void EditorSpellVisible(size_t, const ColumnIndex::Cells&);
+    void EditorSpellQueue(size_t, bool);
+    void EditorSpellBatchEnd();
+    bool EditorSpellPoll();
     void EditorDrawRows(std::string&);
+    void EditorDrawStatusBar(std::string&);
+    size_t RenderCapacity() const;
     void EditorRefreshScreen();
     void EditorMoveCursor(int);
-    void EditorProcessKeypress();
+    void EditorFind(bool);
+    void EditorFindKey(int);
+    bool EditorQueryKey(int, std::string&);
+    void EditorFindLeave(bool);
+    void EditorFindStart(size_t);
+    void EditorFindPlace(bool wait);
+    void EditorFindStep(std::chrono::steady_clock::time_point);
+    void EditorFindStatus();
+    void EditorRegexKey(int);
+    void EditorRegexPoll();
+    void EditorRegexJump(size_t);
+    void EditorRegexStatus();
+    void EditorReplaceKey(int);
+    void EditorReplaceAll();
+    void EditorResize();
+    void EditorProcessKeypress(int);
+    void EditorProcessEvents();
     TextEditor();
     void ShiftLeft();
     void ShiftRight();
     void ShiftUp();
     void ShiftDown();
-    void Type(char);
+    void Type(int);
     void Delete();
     void BackSpace();
     void PasteNewLine();
-    char Delete(Cursor&);
-    char BackSpace(Cursor&);
+    size_t Delete(Cursor&, char*);
+    size_t BackSpace(Cursor&, char*);
     void ReverseNewLine(Cursor&);
     void PasteNewLine(Cursor&);
-    void Type(char, Cursor&);
+    void Type(const char*, size_t, Cursor&);
+    void Restore(const char*, size_t, Cursor&);
+    void InsertText(const std::string&);
+    void InsertText(const std::string&, Cursor&);
+    void EraseText(size_t, Cursor&);
+    void ReplaceAll(std::vector<RegexSearch::Match>, const std::string&);
+    void ApplySplices(const std::vector<Splice>&, std::string*);
     void Undo();
     void Redo();
     void Print(std::ostream& os) const;
     void CheckRedo();
+    size_t Allocations() const;
 };
 
 class TypeAction : public IAction {
-    char symbol_;
+    char symbol_[kUtf8Max];
+    size_t size_;
     Cursor cur_;
 
 public:
-    explicit TypeAction(const char&);
+    TypeAction(const char*, size_t);
     void Do(TextEditor*) override;
     void Undo(TextEditor*) override;
 };
 
 class DelAction : public IAction {
-    char symbol_;
+    char symbol_[kUtf8Max];
+    size_t size_;
     Cursor cur_;
 
 public:
@@ -141,7 +300,8 @@ public:
 };
 
 class BackAction : public IAction {
-    char symbol_;
+    char symbol_[kUtf8Max];
+    size_t size_;
     Cursor cur_;
 
 public:
@@ -159,17 +319,49 @@ public:
     void Undo(TextEditor*) override;
 };
 
-TypeAction::TypeAction(const char& symbol) : symbol_(symbol) {
+class PasteAction : public IAction {
+    std::string text_;
+    Cursor cur_;
+
+public:
+    PasteAction(std::string, const Cursor&);
+    void Do(TextEditor*) override;
+    void Undo(TextEditor*) override;
+};
+
+// A whole replace-all is one action. It keeps where every match was and
+// what it held, so undoing it is one more pass of the same kind.
+class ReplaceAction : public IAction {
+    struct Record {
+        std::vector<RegexSearch::Match> matches;
+        std::string original;
+        std::string with;
+    };
+    std::unique_ptr<Record> record_;
+
+public:
+    ReplaceAction(std::vector<RegexSearch::Match>, const std::string&);
+    void Do(TextEditor*) override;
+    void Undo(TextEditor*) override;
+};
+
+static_assert(sizeof(TypeAction) <= kActionSlot && sizeof(DelAction) <= kActionSlot &&
+              sizeof(BackAction) <= kActionSlot && sizeof(NewLineAction) <= kActionSlot &&
+              sizeof(PasteAction) <= kActionSlot && sizeof(ReplaceAction) <= kActionSlot,
+              "action does not fit a pool slot");
+
+TypeAction::TypeAction(const char* symbol, size_t size) : size_(size) {
+    memcpy(symbol_, symbol, size);
 }
 
 void TypeAction::Do(TextEditor* text) {
-    text->Type(symbol_, cur_);
+    text->Type(symbol_, size_, cur_);
     text->storage_.for_undo.push(this);
 }
 
 void DelAction::Do(TextEditor* text) {
-    symbol_ = text->Delete(cur_);
-    if (symbol_ != '\0') {
+    size_ = text->Delete(cur_, symbol_);
+    if (size_ != 0) {
         text->storage_.for_undo.push(this);
     } else {
         delete this;
@@ -177,8 +369,8 @@ void DelAction::Do(TextEditor* text) {
 }
 
 void BackAction::Do(TextEditor* text) {
-    symbol_ = text->BackSpace(cur_);
-    if (symbol_ != '\0') {
+    size_ = text->BackSpace(cur_, symbol_);
+    if (size_ != 0) {
         text->storage_.for_undo.push(this);
     } else {
         delete this;
@@ -191,8 +383,8 @@ void NewLineAction::Do(TextEditor* text) {
 }
 
 void TypeAction::Undo(TextEditor* text) {
-    symbol_ = text->BackSpace(cur_);
-    if (symbol_ != '\0') {
+    size_ = text->BackSpace(cur_, symbol_);
+    if (size_ != 0) {
         text->storage_.for_redo.push(this);
     } else {
         delete this;
@@ -200,14 +392,12 @@ void TypeAction::Undo(TextEditor* text) {
 }
 
 void DelAction::Undo(TextEditor* text) {
-    text->Type(symbol_, cur_);
-    text->ShiftLeft();
-    cur_ = text->cur_;
+    text->Restore(symbol_, size_, cur_);
     text->storage_.for_redo.push(this);
 }
 
 void BackAction::Undo(TextEditor* text) {
-    text->Type(symbol_, cur_);
+    text->Type(symbol_, size_, cur_);
     text->storage_.for_redo.push(this);
 }
 
@@ -215,19 +405,75 @@ void NewLineAction::Undo(TextEditor* text) {
     text->ReverseNewLine(cur_);
     text->storage_.for_redo.push(this);
 }
+
+PasteAction::PasteAction(std::string text, const Cursor& cursor) : text_(std::move(text)), cur_(cursor) {
+}
+
+void PasteAction::Do(TextEditor* text) {
+    Cursor end = cur_;
+    text->InsertText(text_, end);
+    text->storage_.for_undo.push(this);
+}
+
+void PasteAction::Undo(TextEditor* text) {
+    text->EraseText(text_.size(), cur_);
+    text->storage_.for_redo.push(this);
+}
+
+ReplaceAction::ReplaceAction(std::vector<RegexSearch::Match> matches, const std::string& with)
+    : record_(new Record) {
+    record_->matches = std::move(matches);
+    record_->with = with;
+}
+
+// The first run also saves the replaced text.
+void ReplaceAction::Do(TextEditor* text) {
+    const Record& record = *record_;
+    std::vector<Splice> splices;
+    splices.reserve(record.matches.size());
+    for (const RegexSearch::Match& match : record.matches) {
+        Splice splice = {match.offset, match.length, record.with.data(), record.with.size()};
+        splices.push_back(splice);
+    }
+    text->ApplySplices(splices, record.original.empty() ? &record_->original : nullptr);
+    text->storage_.for_undo.push(this);
+}
+
+void ReplaceAction::Undo(TextEditor* text) {
+    const Record& record = *record_;
+    std::vector<Splice> splices;
+    splices.reserve(record.matches.size());
+    size_t from = 0;
+    for (size_t i = 0; i < record.matches.size(); ++i) {
+        const RegexSearch::Match& match = record.matches[i];
+        Splice splice = {match.offset + i * record.with.size() - from, record.with.size(),
+                         record.original.data() + from, match.length};
+        splices.push_back(splice);
+        from += match.length;
+    }
+    text->ApplySplices(splices, nullptr);
+    text->storage_.for_redo.push(this);
+}
 /*** terminal ***/
 
 struct termios orig_termios;
+// The journal of the open file. It exists on disk only once there are
+// unsaved edits, which die() commits so that they can be recovered.
+Journal* open_journal = nullptr;
 
 void die(const char *s) {
     write(STDOUT_FILENO, "\x1b[2J", 4);
     write(STDOUT_FILENO, "\x1b[H", 3);
 
     perror(s);
+    if (open_journal) {
+        open_journal->Commit(true);
+    }
     exit(1);
 }
 
 void DisableRawMode() {
+    write(STDOUT_FILENO, "\x1b[?2004l", 8);
     if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &orig_termios) == -1) {
         die("tcsetattr");
     }
@@ -245,66 +491,258 @@ void EnableRawMode() {
     raw.c_cflag |= ~(CS8);
     raw.c_lflag &= ~(ECHO | ICANON | ISIG | IEXTEN);
     raw.c_cc[VMIN] = 0;
-    raw.c_cc[VTIME] = 1;
+    raw.c_cc[VTIME] = 0;
 
     if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) == -1) {
         die("tcsetattr");
     }
+    write(STDOUT_FILENO, "\x1b[?2004h", 8);
 }
 
-int EditorReadKey() {
-    int nread;
-    char c;
-    while ((nread = read(STDIN_FILENO, &c, 1)) != 1) {
-        if (nread == -1 && errno != EAGAIN) {
-            die("read");
-        }
+volatile sig_atomic_t window_resized = 0;
+sigset_t wait_mask;
+
+void HandleResize(int) {
+    window_resized = 1;
+}
+
+// SIGWINCH stays blocked except while waiting for input in ppoll(), so a
+// resize either wakes the wait up or is delivered as soon as it starts.
+void EnableResizeSignal() {
+    sigset_t winch;
+    sigemptyset(&winch);
+    sigaddset(&winch, SIGWINCH);
+    sigprocmask(SIG_BLOCK, &winch, &wait_mask);
+    sigdelset(&wait_mask, SIGWINCH);
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = HandleResize;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGWINCH, &sa, nullptr) == -1) {
+        die("sigaction");
     }
+}
 
-    if (c == '\x1b') {
-        char seq[3];
-        if (read(STDIN_FILENO, &seq[0], 1) != 1) {
-            return '\x1b';
+// Keys are decoded from blocks of input: each read() takes everything the
+// terminal has sent so far, and escape sequences and UTF-8 characters go
+// through a state machine that keeps its state between reads, so a sequence
+// split across two reads still decodes. A lone ESC is reported once no more
+// input follows it within kEscapeTimeout. ReadKey returns 0 when no key
+// arrives within timeout milliseconds (-1 waits forever) or a signal
+// interrupts the wait.
+class InputReader {
+    enum State {
+        GROUND,
+        ESCAPE,
+        CSI,
+        SS3,
+        UTF8,
+        PASTE
+    };
+
+    static const int kEscapeTimeout = 100;
+    char buf_[4096];
+    size_t pos_ = 0;
+    size_t len_ = 0;
+    State state_ = GROUND;
+    int param_ = 0;
+    bool first_param_ = true;
+    uint32_t code_ = 0;
+    size_t need_ = 0;
+    std::string paste_;
+
+    bool Fill(int timeout);
+    int Feed(char);
+    int CsiKey(char);
+    bool FeedPaste();
+
+public:
+    int ReadKey(int timeout);
+    void TakePaste(std::string&, const std::string& newline);
+};
+
+InputReader input;
+
+bool InputReader::Fill(int timeout) {
+    struct pollfd pfd = {STDIN_FILENO, POLLIN, 0};
+    struct timespec ts = {timeout / 1000, timeout % 1000 * 1000000L};
+    int ready = ppoll(&pfd, 1, timeout < 0 ? nullptr : &ts, &wait_mask);
+    if (ready == -1 && errno != EINTR) {
+        die("poll");
+    }
+    if (ready <= 0) {
+        return false;
+    }
+    ssize_t nread = read(STDIN_FILENO, buf_, sizeof(buf_));
+    if (nread == -1 && errno != EAGAIN && errno != EINTR) {
+        die("read");
+    }
+    pos_ = 0;
+    len_ = nread > 0 ? nread : 0;
+    return len_ != 0;
+}
+
+int InputReader::ReadKey(int timeout) {
+    while (true) {
+        if (state_ == PASTE && FeedPaste()) {
+            return PASTE_START;
         }
-        if (read(STDIN_FILENO, &seq[1], 1) != 1) {
-            return '\x1b';
+        while (pos_ < len_ && state_ != PASTE) {
+            int key = Feed(buf_[pos_++]);
+            if (key != 0) {
+                return key;
+            }
         }
-        if (seq[0] == '[') {
-            if (seq[1] >= '0' && seq[1] <= '9') {
-                if (read(STDIN_FILENO, &seq[2], 1) != 1)  {
-                    return '\x1b';
-                }
-                if (seq[2] == '~') {
-                    switch (seq[1]) {
-                        case '1': return HOME_KEY;
-                        case '3': return DEL_KEY;
-                        case '4': return END_KEY;
-                        case '5': return PAGE_UP;
-                        case '6': return PAGE_DOWN;
-                        case '7': return HOME_KEY;
-                        case '8': return END_KEY;
-                    }
-                }
-            } else {
-                switch (seq[1]) {
-                    case 'A': return ARROW_UP;
-                    case 'B': return ARROW_DOWN;
-                    case 'C': return ARROW_RIGHT;
-                    case 'D': return ARROW_LEFT;
-                    case 'H': return HOME_KEY;
-                    case 'F': return END_KEY;
+        if (pos_ < len_) {
+            continue;
+        }
+        int wait = state_ == PASTE ? -1 : state_ != GROUND ? kEscapeTimeout : timeout;
+        if (!Fill(wait)) {
+            if (state_ == GROUND || state_ == PASTE) {
+                return 0;
+            }
+            int key = state_ == UTF8 ? kReplacement : '\x1b';
+            state_ = GROUND;
+            return key;
+        }
+    }
+}
+
+int InputReader::Feed(char c) {
+    switch (state_) {
+        case GROUND:
+            if (c == '\x1b') {
+                state_ = ESCAPE;
+                return 0;
+            }
+            if (IsContinuation(c) || Utf8Length(c) == 0) {
+                return kReplacement;
+            }
+            need_ = Utf8Length(c) - 1;
+            if (need_ == 0) {
+                return c;
+            }
+            code_ = static_cast<unsigned char>(c) & (0x7f >> (need_ + 1));
+            state_ = UTF8;
+            return 0;
+        case UTF8:
+            if (!IsContinuation(c)) {
+                state_ = GROUND;
+                --pos_;
+                return kReplacement;
+            }
+            code_ = code_ << 6 | (c & 0x3f);
+            if (--need_ != 0) {
+                return 0;
+            }
+            state_ = GROUND;
+            return code_;
+        case ESCAPE:
+            if (c == '[') {
+                state_ = CSI;
+                param_ = 0;
+                first_param_ = true;
+                return 0;
+            }
+            state_ = c == 'O' ? SS3 : GROUND;
+            return state_ == SS3 ? 0 : '\x1b';
+        case CSI:
+            if (c >= '0' && c <= '9') {
+                if (first_param_ && param_ < 10000) {
+                    param_ = param_ * 10 + (c - '0');
                 }
+                return 0;
             }
-        } else if (seq[0] == 'O') {
-            switch (seq[1]) {
+            if (c == ';') {
+                first_param_ = false;
+                return 0;
+            }
+            if (c < 0x40 || c > 0x7e) {
+                return 0;
+            }
+            state_ = GROUND;
+            return CsiKey(c);
+        case SS3:
+            state_ = GROUND;
+            switch (c) {
+                case 'A': return ARROW_UP;
+                case 'B': return ARROW_DOWN;
+                case 'C': return ARROW_RIGHT;
+                case 'D': return ARROW_LEFT;
                 case 'H': return HOME_KEY;
                 case 'F': return END_KEY;
             }
+            return '\x1b';
+        case PASTE:
+            break;
+    }
+    return 0;
+}
+
+int InputReader::CsiKey(char final) {
+    if (final == '~') {
+        switch (param_) {
+            case 1: return HOME_KEY;
+            case 3: return DEL_KEY;
+            case 4: return END_KEY;
+            case 5: return PAGE_UP;
+            case 6: return PAGE_DOWN;
+            case 7: return HOME_KEY;
+            case 8: return END_KEY;
+            case 200:
+                state_ = PASTE;
+                paste_.clear();
+                return 0;
         }
         return '\x1b';
-    } else {
-        return c;
     }
+    switch (final) {
+        case 'A': return ARROW_UP;
+        case 'B': return ARROW_DOWN;
+        case 'C': return ARROW_RIGHT;
+        case 'D': return ARROW_LEFT;
+        case 'H': return HOME_KEY;
+        case 'F': return END_KEY;
+    }
+    return '\x1b';
+}
+
+// Moves the buffered input into the paste up to the closing ESC[201~,
+// searching only the bytes that could complete it.
+bool InputReader::FeedPaste() {
+    static const char kEnd[] = "\x1b[201~";
+    const size_t end_len = sizeof(kEnd) - 1;
+    size_t from = paste_.size() < end_len ? 0 : paste_.size() - end_len + 1;
+    paste_.append(buf_ + pos_, len_ - pos_);
+    pos_ = len_;
+    size_t end = paste_.find(kEnd, from);
+    if (end == std::string::npos) {
+        return false;
+    }
+    pos_ -= paste_.size() - end - end_len;
+    paste_.resize(end);
+    state_ = GROUND;
+    return true;
+}
+
+// Terminals send line breaks inside a paste as CR, so CR, LF and CRLF all
+// become newline.
+void InputReader::TakePaste(std::string& text, const std::string& newline) {
+    text.clear();
+    text.reserve(paste_.size());
+    for (size_t i = 0; i < paste_.size(); ++i) {
+        if (paste_[i] == '\r' || paste_[i] == '\n') {
+            text += newline;
+            i += paste_[i] == '\r' && i + 1 < paste_.size() && paste_[i + 1] == '\n';
+        } else {
+            text += paste_[i];
+        }
+    }
+    paste_.clear();
+}
+
+int EditorReadKey(int timeout) {
+    return input.ReadKey(timeout);
 }
 
 int GetWindowSize(size_t* rows, size_t* cols) {
@@ -320,24 +758,70 @@ int GetWindowSize(size_t* rows, size_t* cols) {
 
 /*** text_ operations ***/
 
-void TextEditor::EditorAppendRow(char *s, size_t len) {
-    text_.resize(text_.size() + 1);
-    text_[text_.size() - 1] += std::string(s, len);
+size_t TextEditor::Offset() {
+    return text_.LineStart(cur_.y_) + cur_.x_;
+}
+
+// Every edit starts on the cursor line, so that row and, when the edit adds
+// or removes a line break or changes whether the line ends inside a block
+// comment, all rows below it have to be redrawn.
+void TextEditor::Insert(size_t offset, const char* s, size_t n) {
+    long lines = std::count(s, s + n, '\n');
+    bool comment = lines == 0 && highlight_.Enabled() && highlight_.EndsInComment(text_, cur_.y_);
+    size_t x = offset - text_.LineStart(cur_.y_);
+    highlight_.Edit(cur_.y_, cur_.y_ + lines, lines);
+    columns_.Edit(cur_.y_, x, cur_.y_ + lines, lines);
+    spell_.Edit(cur_.y_, x, cur_.y_ + lines, lines);
+    text_.Insert(offset, s, n);
+    journal.Insert(offset, s, n);
+    MarkDirty(cur_.y_, lines != 0 || (highlight_.Enabled() && highlight_.EndsInComment(text_, cur_.y_) != comment));
+}
+
+void TextEditor::Erase(size_t offset, size_t n) {
+    bool below = offset + n > text_.LineStart(cur_.y_) + text_.LineLength(cur_.y_);
+    long lines = 0;
+    if (below) {
+        std::string erased;
+        text_.Copy(offset, n, erased);
+        lines = std::count(erased.begin(), erased.end(), '\n');
+    }
+    bool comment = !below && highlight_.Enabled() && highlight_.EndsInComment(text_, cur_.y_);
+    size_t x = offset - text_.LineStart(cur_.y_);
+    highlight_.Edit(cur_.y_, cur_.y_, -lines);
+    columns_.Edit(cur_.y_, x, cur_.y_, -lines);
+    spell_.Edit(cur_.y_, x, cur_.y_, -lines);
+    text_.Erase(offset, n);
+    journal.Erase(offset, n);
+    MarkDirty(cur_.y_, below || (highlight_.Enabled() && highlight_.EndsInComment(text_, cur_.y_) != comment));
+}
+
+void TextEditor::MarkDirty(size_t line, bool below) {
+    if (line < rowoff && !below) {
+        return;
+    }
+    size_t from = line < rowoff ? 0 : line - rowoff;
+    size_t to = below ? dirty_.size() : from + 1;
+    for (size_t y = from; y < to && y < dirty_.size(); ++y) {
+        dirty_[y] = true;
+    }
 }
 
+// The cursor moves a whole character at a time, and keeps its screen column
+// rather than its byte offset when it changes lines.
 void TextEditor::ShiftLeft() {
     if (cur_.x_ != 0) {
-        --cur_.x_;
+        cur_.x_ = columns_.Prev(text_, cur_.y_, cur_.x_);
     } else if (cur_.y_ > 0) {
         --cur_.y_;
-        cur_.x_ = text_[cur_.y_].size();
+        cur_.x_ = text_.LineLength(cur_.y_);
     }
 }
 
 void TextEditor::ShiftRight() {
-    if (cur_.y_ < text_.size() && cur_.x_ < text_[cur_.y_].size()) {
-        ++cur_.x_;
-    } else if (cur_.y_ < text_.size() - 1 && text_[cur_.y_].size() == cur_.x_) {
+    size_t len = text_.LineLength(cur_.y_);
+    if (cur_.x_ < len) {
+        cur_.x_ = columns_.Next(text_, cur_.y_, cur_.x_);
+    } else if (text_.HasLine(cur_.y_ + 1) && len == cur_.x_) {
         ++cur_.y_;
         cur_.x_ = 0;
     }
@@ -345,19 +829,17 @@ void TextEditor::ShiftRight() {
 
 void TextEditor::ShiftUp() {
     if (cur_.y_ != 0) {
+        size_t column = columns_.Column(text_, cur_.y_, cur_.x_);
         --cur_.y_;
-        if (cur_.y_ < text_.size() && cur_.x_ > text_[cur_.y_].size()) {
-            cur_.x_ = text_[cur_.y_].size();
-        }
+        cur_.x_ = columns_.Byte(text_, cur_.y_, column);
     }
 }
 
 void TextEditor::ShiftDown() {
-    if (cur_.y_ < text_.size() - 1) {
+    if (text_.HasLine(cur_.y_ + 1)) {
+        size_t column = columns_.Column(text_, cur_.y_, cur_.x_);
         ++cur_.y_;
-        if (cur_.y_ < text_.size() && cur_.x_ > (text_[cur_.y_].size())) {
-            cur_.x_ = text_[cur_.y_].size();
-        }
+        cur_.x_ = columns_.Byte(text_, cur_.y_, column);
     }
 }
 
@@ -386,56 +868,77 @@ void TextEditor::PasteNewLine() {
     a->Do(this);
 }
 
-void TextEditor::Type(char symbol) {
+void TextEditor::Type(int symbol) {
     CheckRedo();
-    auto a = new TypeAction(symbol);
+    char bytes[kUtf8Max];
+    auto a = new TypeAction(bytes, EncodeUtf8(symbol, bytes));
     a->Do(this);
 }
 
-char TextEditor::Delete(Cursor& cursor) {
+// Delete and BackSpace remove one code point, so an accent typed after a
+// letter can be taken back on its own, or one line break, and copy it to
+// symbol. They return its length, 0 when there is nothing to remove.
+size_t TextEditor::Delete(Cursor& cursor, char* symbol) {
     if (cursor != cur) {
         cur_ = cursor;
     }
-    char symbol_ = '\0';
-    if (cur_.x_ < text_[cur_.y_].size()) {
-        symbol_ = text_[cur_.y_][cur_.x_];
-        text_[cur_.y_].erase(cur_.x_, 1);
-    } else if (cur_.y_ < text_.size() - 1) {
-        symbol_ = '\n';
-        text_[cur_.y_] += text_[cur_.y_ + 1];
-        text_.erase(text_.begin() + cur_.y_ + 1);
+    size_t n = 0;
+    size_t len = text_.LineLength(cur_.y_);
+    if (cur_.x_ < len) {
+        size_t offset = Offset();
+        char bytes[kUtf8Max];
+        for (; n < kUtf8Max && cur_.x_ + n < len; ++n) {
+            bytes[n] = text_.At(offset + n);
+        }
+        uint32_t code;
+        n = DecodeUtf8(bytes, n, code);
+        memcpy(symbol, bytes, n);
+        Erase(offset, n);
+    } else if (text_.HasLine(cur_.y_ + 1)) {
+        n = text_.LineBreak(cur_.y_);
+        memcpy(symbol, &"\r\n"[2 - n], n);
+        Erase(text_.LineStart(cur_.y_) + len, n);
     }
     cursor = cur_;
-    return symbol_;
+    return n;
 }
 
-char TextEditor::BackSpace(Cursor& cursor) {
+size_t TextEditor::BackSpace(Cursor& cursor, char* symbol) {
     if (cursor != cur) {
         cur_ = cursor;
     }
-    char symbol_ = '\0';
+    size_t n = 0;
     if (cur_.x_ > 0) {
-        symbol_ = text_[cur_.y_][cur_.x_ - 1];
-        text_[cur_.y_].erase(cur_.x_ - 1, 1);
-        ShiftLeft();
+        size_t offset = Offset();
+        char bytes[kUtf8Max];
+        size_t start = 1;
+        while (start < kUtf8Max && start < cur_.x_ && IsContinuation(text_.At(offset - start))) {
+            ++start;
+        }
+        for (size_t i = 0; i < start; ++i) {
+            bytes[i] = text_.At(offset - start + i);
+        }
+        uint32_t code;
+        n = DecodeUtf8(bytes, start, code) == start ? start : 1;
+        memcpy(symbol, bytes + start - n, n);
+        Erase(offset - n, n);
+        cur_.x_ -= n;
     } else if (cur_.y_ > 0) {
         --cur_.y_;
-        cur_.x_ = text_[cur_.y_].size();
-        text_[cur_.y_] += text_[cur_.y_ + 1];
-        text_.erase(text_.begin() + cur_.y_ + 1);
-        symbol_ = '\n';
+        cur_.x_ = text_.LineLength(cur_.y_);
+        n = text_.LineBreak(cur_.y_);
+        memcpy(symbol, &"\r\n"[2 - n], n);
+        Erase(Offset(), n);
     }
     cursor = cur_;
-    return symbol_;
+    return n;
 }
 
 void TextEditor::PasteNewLine(Cursor& cursor) {
     if (cursor != cur) {
         cur_ = cursor;
     }
-    text_.insert(text_.begin() + cur_.y_ + 1,
-    text_[cur_.y_].substr(cur_.x_, text_[cur_.y_].size() - cur_.x_));
-    text_[cur_.y_].resize(cur_.x_);
+    Insert(Offset(), newline_.data(), newline_.size());
     cur_.y_++;
     cur_.x_ = 0;
     cursor = cur_;
@@ -446,29 +949,191 @@ void TextEditor::ReverseNewLine(Cursor& cursor) {
         cur_ = cursor;
     }
     --cur_.y_;
-    cur_.x_ = text_[cur_.y_].size();
-    text_[cur_.y_] += text_[cur_.y_ + 1];
-    text_.erase(text_.begin() + cur_.y_ + 1);
+    cur_.x_ = text_.LineLength(cur_.y_);
+    Erase(Offset(), text_.LineBreak(cur_.y_));
     cursor = cur_;
 }
 
-void TextEditor::Type(char symbol, Cursor& cursor) {
+void TextEditor::Type(const char* symbol, size_t n, Cursor& cursor) {
     if (cursor != cur) {
         cur_ = cursor;
     }
-    if (symbol == '\n') {
-        text_.insert(text_.begin() + cur_.y_ + 1,
-        text_[cur_.y_].substr(cur_.x_, text_[cur_.y_].size() - cur_.x_));
-        text_[cur_.y_].resize(cur_.x_);
+    Insert(Offset(), symbol, n);
+    if (symbol[n - 1] == '\n') {
         cur_.y_++;
         cur_.x_ = 0;
     } else {
-        text_[cur_.y_].insert(cur_.x_, std::string(1, symbol));
-        ShiftRight();
+        cur_.x_ += n;
+    }
+    cursor = cur_;
+}
+
+// Puts back what Delete removed, leaving the cursor in front of it.
+void TextEditor::Restore(const char* symbol, size_t n, Cursor& cursor) {
+    if (cursor != cur) {
+        cur_ = cursor;
     }
+    Insert(Offset(), symbol, n);
     cursor = cur_;
 }
 
+void TextEditor::InsertText(const std::string& text) {
+    if (text.empty()) {
+        return;
+    }
+    CheckRedo();
+    auto a = new PasteAction(text, cur_);
+    a->Do(this);
+}
+
+void TextEditor::InsertText(const std::string& text, Cursor& cursor) {
+    cur_ = cursor;
+    Insert(Offset(), text.data(), text.size());
+    size_t last = text.rfind('\n');
+    if (last == std::string::npos) {
+        cur_.x_ += text.size();
+    } else {
+        cur_.y_ += std::count(text.begin(), text.end(), '\n');
+        cur_.x_ = text.size() - last - 1;
+    }
+    cursor = cur_;
+}
+
+void TextEditor::EraseText(size_t n, Cursor& cursor) {
+    cur_ = cursor;
+    Erase(Offset(), n);
+}
+
+// Replaces every match, which must be sorted and must not overlap.
+void TextEditor::ReplaceAll(std::vector<RegexSearch::Match> matches, const std::string& with) {
+    if (matches.empty()) {
+        return;
+    }
+    CheckRedo();
+    auto a = new ReplaceAction(std::move(matches), with);
+    a->Do(this);
+}
+
+// Applies sorted, disjoint splices as one batch. Splices less than
+// kSpliceGap apart share a block of whole lines, line breaks included, so
+// that a splice ending in a CRLF stays inside its block; a block is about
+// kSpliceBlock bytes at most. Every block is built once from the text as it
+// is, in parallel for large batches, and then replaces its lines with one
+// erase and one insert, the last block first so that the offsets of the
+// others still hold. removed, when given, receives the bytes the splices cover,
+// one after another. The cursor ends up where the first splice starts.
+void TextEditor::ApplySplices(const std::vector<Splice>& splices, std::string* removed) {
+    struct Block {
+        size_t first;
+        size_t last;
+        size_t line;
+        size_t last_line;
+        size_t begin;
+        size_t end;
+        std::string text;
+    };
+    if (splices.empty()) {
+        return;
+    }
+    std::vector<Block> blocks;
+    std::vector<size_t> at(splices.size());
+    size_t total = 0;
+    for (size_t i = 0; i < splices.size();) {
+        at[i] = total;
+        total += splices[i].length;
+        size_t end = splices[i].offset + splices[i].length;
+        size_t j = i + 1;
+        for (; j < splices.size() && splices[j].offset < end + kSpliceGap &&
+               end - splices[i].offset < kSpliceBlock;
+             ++j) {
+            at[j] = total;
+            total += splices[j].length;
+            end = splices[j].offset + splices[j].length;
+        }
+        size_t last = text_.LineAt(end);
+        end = text_.LineStart(last) + text_.LineLength(last) + text_.LineBreak(last);
+        if (!blocks.empty() && splices[i].offset < blocks.back().end) {
+            blocks.back().last = j;
+            blocks.back().last_line = last;
+            blocks.back().end = end;
+        } else {
+            Block block;
+            block.first = i;
+            block.last = j;
+            block.line = text_.LineAt(splices[i].offset);
+            block.last_line = last;
+            block.begin = text_.LineStart(block.line);
+            block.end = end;
+            blocks.push_back(std::move(block));
+        }
+        i = j;
+    }
+    if (removed) {
+        removed->assign(total, '\0');
+    }
+    std::atomic<size_t> next(0);
+    auto build = [&]() {
+        std::string scratch;
+        size_t k;
+        while ((k = next++) < blocks.size()) {
+            Block& block = blocks[k];
+            size_t pos = block.begin;
+            for (size_t i = block.first; i < block.last; ++i) {
+                const Splice& splice = splices[i];
+                text_.Copy(pos, splice.offset - pos, block.text);
+                if (removed) {
+                    scratch.clear();
+                    text_.Copy(splice.offset, splice.length, scratch);
+                    scratch.copy(&(*removed)[at[i]], splice.length);
+                }
+                block.text.append(splice.text, splice.size);
+                pos = splice.offset + splice.length;
+            }
+            text_.Copy(pos, block.end - pos, block.text);
+        }
+    };
+    size_t threads = 1;
+    if (blocks.back().end - blocks.front().begin >= kSpliceBlock) {
+        threads = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), blocks.size());
+    }
+    std::vector<std::thread> workers;
+    for (size_t t = 1; t < threads; ++t) {
+        workers.push_back(std::thread(build));
+    }
+    build();
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    // The blocks are spliced in without Insert and Erase, so that the
+    // caches see the whole batch as one edit, from the first block's line
+    // to the last block's, rather than shifting their lines once per block.
+    long lines = 0;
+    for (const Block& block : blocks) {
+        lines += std::count(block.text.begin(), block.text.end(), '\n');
+        lines -= static_cast<long>(block.last_line - block.line + (block.end != text_.Size()));
+    }
+    size_t first = blocks.front().line;
+    size_t last = blocks.back().last_line + lines;
+    size_t x = splices[0].offset - blocks.front().begin;
+    MarkDirty(first, true);
+    highlight_.Edit(first, last, lines);
+    columns_.Edit(first, x, last, lines);
+    spell_.Edit(first, x, last, lines);
+    for (size_t k = blocks.size(); k-- > 0;) {
+        const Block& block = blocks[k];
+        if (block.end != block.begin) {
+            text_.Erase(block.begin, block.end - block.begin);
+            journal.Erase(block.begin, block.end - block.begin);
+        }
+        if (!block.text.empty()) {
+            text_.Insert(block.begin, block.text.data(), block.text.size());
+            journal.Insert(block.begin, block.text.data(), block.text.size());
+        }
+    }
+    cur_.y_ = first;
+    cur_.x_ = x;
+}
+
 void TextEditor::Undo() {
     if (!storage_.for_undo.empty()) {
         storage_.for_undo.top()->Undo(this);
@@ -483,110 +1148,838 @@ void TextEditor::Redo() {
     }
 }
 
+size_t TextEditor::Allocations() const {
+    return text_.Allocations() + IAction::allocations;
+}
+
 /*** file i/o ***/
 
+// Every line keeps the break it was read with, LF or CRLF, and the breaks
+// typed into the file follow its first line. The break after the last
+// line, which the text leaves out, is kept in ending_ to be written back;
+// a file that was empty gets one once it has text.
 void TextEditor::EditorOpen(char *filename) {
-    FILE *fp = fopen(filename, "r");
-    if (!fp) {
-        die("fopen");
+    std::unique_ptr<MappedFile> file = MappedFile::Open(filename);
+    if (!file) {
+        die("open");
     }
-    char* line = NULL;
-    size_t linecap = 0;
-    ssize_t linelen;
-    while ((linelen = getline(&line, &linecap, fp)) != -1) {
-        while (linelen > 0 && (line[linelen - 1] == '\n' ||
-                               line[linelen - 1] == '\r')) {
-            linelen--;
-        }
-        EditorAppendRow(line, linelen);
+    this->filename = filename;
+    const char* data = file->Data();
+    size_t size = file->Size();
+    ending_ = size == 0 || data[size - 1] != '\n' ? "" : size > 1 && data[size - 2] == '\r' ? "\r\n" : "\n";
+    was_empty_ = size == 0;
+    text_ = PieceTable(std::move(file));
+    text_.LoadInBackground();
+    size_t first = text_.LineBreak(0);
+    newline_ = (first != 0 ? first : ending_.size()) == 2 ? "\r\n" : "\n";
+    if (was_empty_) {
+        ending_ = newline_;
+    }
+    if (newline_.size() == 2) {
+        statusmsg = "CRLF";
+    }
+    cur_ = Cursor();
+    shadow_.clear();
+    highlight_.Enable(Highlighter::Supports(this->filename));
+    columns_.Clear();
+    spell_.Clear();
+    size_t replayed = journal.Open(this->filename, text_);
+    open_journal = &journal;
+    if (replayed != 0) {
+        statusmsg = "recovered " + std::to_string(replayed) + " edits";
+    }
+    if (journal.Error() != 0) {
+        statusmsg = std::string("no journal: ") + strerror(journal.Error());
+    }
+}
+
+// Writes to a temporary file next to the target and renames it over the
+// target, so a failed save never leaves a truncated file behind. A symlink
+// is followed, so that the file it points to is replaced rather than the
+// link.
+void TextEditor::EditorSave() {
+    if (filename.empty()) {
+        statusmsg = "no file name";
+        return;
+    }
+    char* real = realpath(filename.c_str(), nullptr);
+    std::string target = real ? real : filename;
+    free(real);
+    std::string tmp = target + ".XXXXXX";
+    int fd = mkstemp(&tmp[0]);
+    if (fd == -1) {
+        statusmsg = std::string("save failed: ") + strerror(errno);
+        return;
+    }
+    struct stat st;
+    fchmod(fd, stat(target.c_str(), &st) == 0 ? st.st_mode & 07777 : 0644);
+    size_t ending = was_empty_ && text_.Size() == 0 ? 0 : ending_.size();
+    bool ok = text_.WriteTo(fd) && (ending == 0 || write(fd, ending_.data(), ending) == ssize_t(ending)) &&
+              fsync(fd) == 0;
+    if (close(fd) == -1) {
+        ok = false;
+    }
+    if (!ok || rename(tmp.c_str(), target.c_str()) == -1) {
+        statusmsg = std::string("save failed: ") + strerror(errno);
+        unlink(tmp.c_str());
+        return;
     }
-    free(line);
-    fclose(fp);
+    journal.Reset(filename);
+    char buff[64];
+    snprintf(buff, sizeof(buff), "%zu bytes written", text_.Size() + ending);
+    statusmsg = buff;
 }
 
 /*** output ***/
 
+int StyleColor(Highlighter::Style style) {
+    switch (style) {
+        case Highlighter::kComment: return 36;
+        case Highlighter::kKeyword: return 33;
+        case Highlighter::kType: return 32;
+        case Highlighter::kString: return 35;
+        case Highlighter::kNumber: return 31;
+        default: return 39;
+    }
+}
+
+void AppendMoveTo(std::string& ab, size_t row, size_t col) {
+    char buff[48];
+    ab.append(buff, snprintf(buff, sizeof(buff), "\x1b[%zu;%zuH", row, col));
+}
+
+// coloff and rx_, the cursor column, count screen columns, not bytes.
 void TextEditor::EditorScroll() {
+    rx_ = columns_.Column(text_, cur_.y_, cur_.x_);
     if (cur_.y_ < rowoff) {
         rowoff = cur_.y_;
     }
     if (cur_.y_ >= rowoff + screenrows) {
         rowoff = cur_.y_ - screenrows + 1;
     }
-    if (cur_.x_ < coloff) {
-        coloff = cur_.x_;
+    if (rx_ < coloff) {
+        coloff = rx_;
     }
-    if (cur_.x_ >= coloff + screencols) {
-        coloff = cur_.x_ - screencols + 1;
+    if (rx_ >= coloff + screencols) {
+        coloff = rx_ - screencols + 1;
     }
 }
 
-void TextEditor::EditorDrawRows(std::string& ab) {
-    for (size_t y = 0; y < screenrows; y++) {
-        int filerow = y + rowoff;
-        if (filerow >= static_cast<int>(text_.size())) {
-            if (text_.size() == 1 && text_[0].size() == 0 && y == screenrows / 3) {
-                char welcome[80];
-                size_t welcomelen = snprintf(welcome, sizeof(welcome),
-                    "term editor -- version %s", TERM_EDITOR_VERSION);
-                if (welcomelen > screencols) {
-                    welcomelen = screencols;
-                }
-                int padding = (screencols - welcomelen) / 2;
-                if (padding) {
-                    ab += "~";
-                    padding--;
-                }
-                while (padding--) {
-                    ab += " ";
-                }
-                ab.append(welcome, welcomelen);
-            } else {
-                ab += "~";
+// Shifts the text area by delta rows with a scroll region instead of
+// redrawing it; only the rows scrolled into view are left dirty.
+void TextEditor::EditorScrollRows(std::string& ab, size_t oldrowoff) {
+    size_t delta = rowoff > oldrowoff ? rowoff - oldrowoff : oldrowoff - rowoff;
+    if (delta >= screenrows) {
+        dirty_.assign(screenrows, true);
+        return;
+    }
+    char buff[64];
+    ab.append(buff, snprintf(buff, sizeof(buff), "\x1b[1;%zur\x1b[%zu%c\x1b[r", screenrows, delta,
+                             rowoff > oldrowoff ? 'S' : 'T'));
+    size_t blank;
+    if (rowoff > oldrowoff) {
+        std::rotate(shadow_.begin(), shadow_.begin() + delta, shadow_.begin() + screenrows);
+        std::rotate(dirty_.begin(), dirty_.begin() + delta, dirty_.end());
+        blank = screenrows - delta;
+    } else {
+        std::rotate(shadow_.begin(), shadow_.begin() + screenrows - delta, shadow_.begin() + screenrows);
+        std::rotate(dirty_.begin(), dirty_.begin() + screenrows - delta, dirty_.end());
+        blank = 0;
+    }
+    for (size_t y = blank; y < blank + delta; ++y) {
+        shadow_[y].clear();
+        dirty_[y] = true;
+    }
+}
+
+void TextEditor::EditorDrawRow(size_t y, std::string& row) {
+    size_t filerow = y + rowoff;
+    if (!text_.HasLine(filerow)) {
+        if (text_.Size() == 0 && y == screenrows / 3) {
+            char welcome[80];
+            size_t welcomelen = snprintf(welcome, sizeof(welcome),
+                "term editor -- version %s", TERM_EDITOR_VERSION);
+            if (welcomelen > screencols) {
+                welcomelen = screencols;
             }
-        } else {
-            int len = text_[filerow].size() - coloff;
-            if (len < 0) {
-                len = 0;
+            size_t padding = (screencols - welcomelen) / 2;
+            if (padding) {
+                row += '~';
+                padding--;
             }
-            if (len > static_cast<int>(screencols)) {
-                len = screencols;
+            row.append(padding, ' ');
+            row.append(welcome, welcomelen);
+        } else {
+            row += '~';
+        }
+    } else {
+        // Only the bytes behind the visible columns are read, however long
+        // the line is.
+        ColumnIndex::Cells cells = columns_.Window(text_, filerow, coloff, screencols);
+        window_.clear();
+        text_.Copy(text_.LineStart(filerow) + cells.begin, cells.end - cells.begin, window_);
+        if (!window_.empty() && (highlight_.Enabled() || spell_.Enabled() || (searching_ && !query_.empty()))) {
+            EditorDrawCells(filerow, cells, row);
+        } else {
+            size_t at = cells.column;
+            ColumnIndex::Expand(window_.data(), window_.size(), at, coloff, coloff + screencols, row);
+        }
+    }
+}
+
+// Draws the cells in window_, switching attributes at the edges of the
+// highlight spans, the search matches and the misspelled words that overlap
+// them.
+void TextEditor::EditorDrawCells(size_t filerow, const ColumnIndex::Cells& cells, std::string& row) {
+    size_t end = cells.begin + window_.size();
+    marks_.clear();
+    if (highlight_.Enabled()) {
+        const std::vector<Highlighter::Span>& spans = highlight_.Spans(text_, filerow);
+        for (size_t i = 0; i < spans.size() && spans[i].start < end; ++i) {
+            if (spans[i].start + spans[i].length > cells.begin) {
+                Mark on = {std::max(spans[i].start, cells.begin), StyleColor(spans[i].style)};
+                Mark off = {std::min(spans[i].start + spans[i].length, end), 39};
+                marks_.push_back(on);
+                marks_.push_back(off);
             }
-            if (len > 0) {
-                ab.append(text_[filerow], coloff, len);
+        }
+    }
+    matches_.clear();
+    if (searching_ && !query_.empty()) {
+        EditorFindVisible(filerow, cells);
+    }
+    misspelled_.clear();
+    if (spell_.Enabled()) {
+        EditorSpellVisible(filerow, cells);
+    }
+    size_t at = cells.begin;
+    size_t column = cells.column;
+    size_t i = 0;
+    size_t j = 0;
+    size_t k = 0;
+    while (i < marks_.size() || j < matches_.size() || k < misspelled_.size()) {
+        size_t color = i < marks_.size() ? marks_[i].pos : kNotFound;
+        size_t match = j < matches_.size() ? matches_[j].pos : kNotFound;
+        size_t word = k < misspelled_.size() ? misspelled_[k].pos : kNotFound;
+        const Mark& mark = color <= std::min(match, word) ? marks_[i++] : match <= word ? matches_[j++]
+                                                                                          : misspelled_[k++];
+        ColumnIndex::Expand(window_.data() + (at - cells.begin), mark.pos - at, column, coloff, coloff + screencols,
+                            row);
+        char buff[16];
+        row.append(buff, snprintf(buff, sizeof(buff), "\x1b[%dm", mark.sgr));
+        at = mark.pos;
+    }
+    ColumnIndex::Expand(window_.data() + (at - cells.begin), end - at, column, coloff, coloff + screencols, row);
+}
+
+// Finds the occurrences of the query that overlap the drawn bytes, looking
+// a query length to either side for the ones cut by the window.
+void TextEditor::EditorFindVisible(size_t filerow, const ColumnIndex::Cells& cells) {
+    if (regex_) {
+        EditorRegexVisible(filerow, cells);
+        return;
+    }
+    size_t m = query_.size();
+    size_t end = cells.begin + window_.size();
+    size_t from = cells.begin - std::min(cells.begin, m - 1);
+    size_t to = std::min(text_.LineLength(filerow), end + m - 1);
+    found_.clear();
+    text_.Copy(text_.LineStart(filerow) + from, to - from, found_);
+    size_t pos = 0;
+    size_t at;
+    while ((at = FindBytes(found_.data() + pos, found_.size() - pos, query_.data(), m)) != kNotFound) {
+        at += pos + from;
+        if (at + m > cells.begin && at < end) {
+            Mark on = {std::max(at, cells.begin), 7};
+            Mark off = {std::min(at + m, end), 27};
+            matches_.push_back(on);
+            matches_.push_back(off);
+        }
+        pos = at + m - from;
+    }
+}
+
+// Regex matches do not overlap and do not span lines, so at most one match
+// that starts before the window reaches into it.
+void TextEditor::EditorRegexVisible(size_t filerow, const ColumnIndex::Cells& cells) {
+    size_t start = text_.LineStart(filerow);
+    size_t begin = start + cells.begin;
+    size_t end = begin + window_.size();
+    RegexSearch::Match key = {begin, 0};
+    std::vector<RegexSearch::Match>::const_iterator it = std::lower_bound(
+        regex_matches_.begin(), regex_matches_.end(), key,
+        [](const RegexSearch::Match& a, const RegexSearch::Match& b) { return a.offset < b.offset; });
+    if (it != regex_matches_.begin() && (it - 1)->offset + (it - 1)->length > begin) {
+        --it;
+    }
+    for (; it != regex_matches_.end() && it->offset < end; ++it) {
+        Mark on = {std::max(it->offset, begin) - start, 7};
+        Mark off = {std::min(it->offset + it->length, end) - start, 27};
+        matches_.push_back(on);
+        matches_.push_back(off);
+    }
+}
+
+// Underlines the misspelled words that overlap the drawn bytes, and queues
+// the line to be checked first when it has changed since its last check.
+void TextEditor::EditorSpellVisible(size_t filerow, const ColumnIndex::Cells& cells) {
+    if (spell_.Needs(filerow)) {
+        EditorSpellQueue(filerow, true);
+    }
+    size_t end = cells.begin + window_.size();
+    const std::vector<SpellChecker::Span>& spans = spell_.Spans(filerow);
+    for (size_t i = 0; i < spans.size() && spans[i].start < end; ++i) {
+        if (spans[i].start + spans[i].length > cells.begin) {
+            Mark on = {std::max(spans[i].start, cells.begin), 4};
+            Mark off = {std::min(spans[i].start + spans[i].length, end), 24};
+            misspelled_.push_back(on);
+            misspelled_.push_back(off);
+        }
+    }
+}
+
+// Hands the checker a snapshot and the first SpellChecker::kMaxLine bytes
+// of a line in it, which the worker copies out. The lines queued by one
+// frame or one poll share a snapshot. In a highlighted source only comments
+// and strings are prose.
+void TextEditor::EditorSpellQueue(size_t filerow, bool urgent) {
+    size_t length = text_.LineLength(filerow);
+    size_t n = std::min(length, SpellChecker::kMaxLine);
+    std::vector<SpellChecker::Span> prose;
+    if (highlight_.Enabled()) {
+        for (const Highlighter::Span& span : highlight_.Spans(text_, filerow)) {
+            if ((span.style == Highlighter::kComment || span.style == Highlighter::kString) && span.start < n) {
+                SpellChecker::Span part = {span.start, span.length};
+                prose.push_back(part);
             }
         }
+    } else {
+        SpellChecker::Span all = {0, n};
+        prose.push_back(all);
+    }
+    if (!spell_batch_) {
+        spell_text_ = text_.TakeSnapshot();
+        spell_batch_ = true;
+    }
+    spell_.Check(filerow, spell_text_, text_.LineStart(filerow), n, n == length, std::move(prose), urgent);
+}
 
-        ab += "\x1b[K";
-        if (y < screenrows - 1) {
-            ab += "\r\n";
+// Lets go of the snapshot shared by the lines queued since the last call,
+// so that it does not pin the table past the frame or poll that took it.
+void TextEditor::EditorSpellBatchEnd() {
+    if (spell_batch_) {
+        spell_text_ = PieceTable::Snapshot();
+        spell_batch_ = false;
+    }
+}
+
+// Marks the rows whose words the checker has finished, and returns whether
+// there were any. Once nothing is pending, the screens above and below are
+// queued behind whatever comes up next, so scrolling finds them checked.
+bool TextEditor::EditorSpellPoll() {
+    spelled_.clear();
+    spell_.Poll(spelled_);
+    bool redraw = false;
+    for (size_t line : spelled_) {
+        if (line >= rowoff && line - rowoff < dirty_.size()) {
+            dirty_[line - rowoff] = true;
+            redraw = true;
+        }
+    }
+    if (spell_.Pending()) {
+        return redraw;
+    }
+    size_t from = rowoff - std::min(rowoff, screenrows);
+    for (size_t y = from; y < rowoff + 2 * screenrows && text_.HasLine(y); ++y) {
+        if ((y < rowoff || y >= rowoff + screenrows) && spell_.Needs(y)) {
+            EditorSpellQueue(y, false);
         }
     }
+    EditorSpellBatchEnd();
+    return redraw;
 }
 
+// Rows are redrawn only when dirty, and written only when they differ from
+// what the terminal already shows according to the shadow frame. No edit
+// marks the welcome row, so it is dirtied here when the buffer becomes or
+// stops being empty.
+void TextEditor::EditorDrawRows(std::string& ab) {
+    if (welcome_ != (text_.Size() == 0)) {
+        welcome_ = !welcome_;
+        dirty_[screenrows / 3] = true;
+    }
+    for (size_t y = 0; y < screenrows; y++) {
+        if (!dirty_[y]) {
+            continue;
+        }
+        dirty_[y] = false;
+        row_.clear();
+        EditorDrawRow(y, row_);
+        if (row_ == shadow_[y]) {
+            continue;
+        }
+        AppendMoveTo(ab, y + 1, 1);
+        ab += row_;
+        ab += "\x1b[K";
+        shadow_[y] = row_;
+    }
+    EditorSpellBatchEnd();
+}
+
+void TextEditor::EditorDrawStatusBar(std::string& ab) {
+    char status[80];
+    char position[80];
+    int len = snprintf(status, sizeof(status), "%.40s%s%.30s", filename.empty() ? "[No Name]" : filename.c_str(),
+                       statusmsg.empty() ? "" : " | ", statusmsg.c_str());
+    int poslen = 0;
+    if (show_frame_stats_) {
+        long us = std::chrono::duration_cast<std::chrono::microseconds>(frame_time_).count();
+        poslen = snprintf(position, sizeof(position), "%ldus %zu | ", us, frame_allocations_);
+    }
+    if (text_.Loading()) {
+        poslen += snprintf(position + poslen, sizeof(position) - poslen, "loading %zu%% | %zu",
+                           text_.LoadProgress(), cur_.y_ + 1);
+    } else {
+        poslen += snprintf(position + poslen, sizeof(position) - poslen, "%zu/%zu", cur_.y_ + 1, text_.LineCount());
+    }
+    if (len > static_cast<int>(screencols)) {
+        len = screencols;
+    }
+    ab += "\x1b[7m";
+    ab.append(status, len);
+    if (len + poslen <= static_cast<int>(screencols)) {
+        ab.append(screencols - len - poslen, ' ');
+        ab.append(position, poslen);
+    } else {
+        ab.append(screencols - len, ' ');
+    }
+    ab += "\x1b[m";
+}
+
+size_t TextEditor::RenderCapacity() const {
+    size_t capacity = frame_.capacity() + row_.capacity() + status_.capacity();
+    for (size_t y = 0; y < shadow_.size(); ++y) {
+        capacity += shadow_[y].capacity();
+    }
+    return capacity;
+}
+
+// A frame is composed into frame_, which together with the row and status
+// scratch strings and the shadow rows is sized for a full screen on resize
+// and only cleared afterwards. frame_allocations_ counts the frames that
+// still had to grow one of them, which should stay at zero in steady state.
 void TextEditor::EditorRefreshScreen() {
+    typedef std::chrono::steady_clock Clock;
+    Clock::time_point start = Clock::now();
+    last_frame_ = start;
+    size_t oldrowoff = rowoff;
+    size_t oldcoloff = coloff;
     EditorScroll();
-    std::string ab;
+    frame_.clear();
+
+    frame_ += "\x1b[?25l";
+    if (shadow_.size() != screenrows + 1) {
+        frame_ += "\x1b[2J";
+        shadow_.assign(screenrows + 1, std::string());
+        for (size_t y = 0; y <= screenrows; ++y) {
+            shadow_[y].reserve(screencols * 8 + 16);
+        }
+        dirty_.assign(screenrows, true);
+        row_.reserve(screencols * 8 + 16);
+        window_.reserve(screencols * 8 + 16);
+        status_.reserve(screencols + 16);
+        frame_.reserve((screenrows + 1) * (screencols * 8 + 32) + 128);
+    } else if (coloff != oldcoloff) {
+        dirty_.assign(screenrows, true);
+    } else if (rowoff != oldrowoff) {
+        EditorScrollRows(frame_, oldrowoff);
+    }
+    size_t capacity = RenderCapacity();
+
+    EditorDrawRows(frame_);
+    status_.clear();
+    EditorDrawStatusBar(status_);
+    if (status_ != shadow_[screenrows]) {
+        AppendMoveTo(frame_, screenrows + 1, 1);
+        frame_ += status_;
+        shadow_[screenrows] = status_;
+    }
+    AppendMoveTo(frame_, (cur_.y_ - rowoff) + 1, (rx_ - coloff) + 1);
 
-    ab += "\x1b[?25l";
-    ab += "\x1b[H";
+    frame_ += "\x1b[?25h";
 
-    EditorDrawRows(ab);
-    char buff[32];
-    snprintf(buff, sizeof(buff), "\x1b[%ld;%ldH", (cur_.y_ - rowoff) + 1, (cur_.x_ - coloff) + 1);
-    ab.append(buff, strlen(buff));
+    write(STDOUT_FILENO, frame_.data(), frame_.size());
+    if (RenderCapacity() != capacity) {
+        ++frame_allocations_;
+    }
+    frame_time_ = Clock::now() - start;
+}
 
-    ab += "\x1b[?25h";
+void TextEditor::Print(std::ostream& os) const {
+    text_.Print(os);
+    os << '\n';
+}
 
-    write(STDOUT_FILENO, ab.c_str(), ab.size());
+/*** find ***/
+
+// Ctrl-F searches as the query is typed. The scan runs in slices between
+// frames, so a query that matches late in a large file never holds up the
+// next key, and a longer query resumes from the match of the shorter one,
+// since any later match of it is also a match of the shorter query.
+void TextEditor::EditorFind(bool regex) {
+    searching_ = true;
+    regex_ = regex;
+    regex_ran_ = false;
+    regex_bad_ = false;
+    regex_at_ = kNotFound;
+    regex_matches_.clear();
+    query_.clear();
+    saved_ = cur_;
+    saved_rowoff_ = rowoff;
+    saved_coloff_ = coloff;
+    origin_ = Offset();
+    match_ = kNotFound;
+    scan_ = kNotFound;
+    EditorFindStatus();
 }
 
-void TextEditor::Print(std::ostream& os) const {
-    for (auto a : text_) {
-        os << a  << '\n';
+void TextEditor::EditorFindKey(int symbol) {
+    if (replacing_) {
+        EditorReplaceKey(symbol);
+        return;
+    }
+    if (symbol == '\t') {
+        replacing_ = true;
+        replacement_.clear();
+        EditorFindStatus();
+        return;
+    }
+    if (regex_) {
+        EditorRegexKey(symbol);
+        return;
+    }
+    switch (symbol) {
+        case '\x1b':
+            EditorFindLeave(true);
+            break;
+        case 13:
+            EditorFindLeave(false);
+            break;
+        case CTRL_KEY('f'):
+        case ARROW_DOWN:
+        case ARROW_RIGHT:
+            if (match_ != kNotFound) {
+                EditorFindStart(match_ + 1);
+            }
+            break;
+        case 127:
+            if (query_.empty()) {
+                break;
+            }
+            EditorQueryKey(symbol, query_);
+            EditorFindStart(origin_);
+            break;
+        default:
+            bool fresh = query_.empty();
+            if (!EditorQueryKey(symbol, query_)) {
+                EditorFindLeave(false);
+                EditorProcessKeypress(symbol);
+                return;
+            }
+            if (fresh) {
+                EditorFindStart(origin_);
+            } else if (match_ != kNotFound) {
+                scan_ = match_;
+                match_ = kNotFound;
+            }
+            break;
+    }
+    dirty_.assign(dirty_.size(), true);
+    if (searching_) {
+        EditorFindStatus();
     }
 }
 
+// Applies a key that edits a prompt: Backspace drops its last character,
+// and typed or pasted text is appended up to the first line break.
+bool TextEditor::EditorQueryKey(int symbol, std::string& query) {
+    if (symbol == 127) {
+        while (!query.empty() && IsContinuation(query[query.size() - 1])) {
+            query.erase(query.size() - 1);
+        }
+        if (!query.empty()) {
+            query.erase(query.size() - 1);
+        }
+    } else if (symbol == PASTE_START) {
+        std::string text;
+        input.TakePaste(text, "\n");
+        query.append(text, 0, text.find_first_of("\r\n"));
+    } else if (symbol >= ' ' && symbol < ARROW_LEFT) {
+        char buff[kUtf8Max];
+        query.append(buff, EncodeUtf8(symbol, buff));
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Leaving with the match kept takes the cursor to it even if the loader
+// has yet to get that far.
+void TextEditor::EditorFindLeave(bool restore) {
+    if (restore) {
+        cur_ = saved_;
+        rowoff = saved_rowoff_;
+        coloff = saved_coloff_;
+    } else {
+        EditorFindPlace(true);
+    }
+    regex_search_.Stop();
+    regex_scanning_ = false;
+    regex_ = false;
+    replacing_ = false;
+    searching_ = false;
+    dirty_.assign(dirty_.size(), true);
+}
+
+// Looks for the query from offset from on, wrapping around once.
+void TextEditor::EditorFindStart(size_t from) {
+    size_t size = text_.Size();
+    match_ = kNotFound;
+    scan_ = from < size ? from : 0;
+    stop_ = scan_;
+    wrapped_ = false;
+    if (query_.empty()) {
+        scan_ = kNotFound;
+        cur_ = saved_;
+    }
+}
+
+// Scans a slice at a time until a match turns up or the next frame is due.
+void TextEditor::EditorFindStep(std::chrono::steady_clock::time_point deadline) {
+    while (scan_ != kNotFound) {
+        size_t end = wrapped_ ? stop_ : text_.Size();
+        size_t to = std::min(end, scan_ + kSearchSlice);
+        size_t at = scan_ < to ? text_.Find(query_, scan_, to) : kNotFound;
+        if (at != kNotFound) {
+            match_ = at;
+            placed_ = false;
+            scan_ = kNotFound;
+            EditorFindPlace(false);
+            break;
+        }
+        scan_ = to;
+        if (scan_ >= end) {
+            if (wrapped_) {
+                scan_ = kNotFound;
+                break;
+            }
+            wrapped_ = true;
+            scan_ = 0;
+        }
+        if (std::chrono::steady_clock::now() >= deadline) {
+            break;
+        }
+    }
+    EditorFindStatus();
+}
+
+// Moves the cursor to the match once the loader has indexed the text up to
+// it, so that finding its line does not wait for the loader; until then
+// the match is looked at again every frame.
+void TextEditor::EditorFindPlace(bool wait) {
+    if (match_ == kNotFound || placed_ || (!wait && !text_.Reached(match_ + 1))) {
+        return;
+    }
+    placed_ = true;
+    cur_.y_ = text_.LineAt(match_);
+    cur_.x_ = match_ - text_.LineStart(cur_.y_);
+    dirty_.assign(dirty_.size(), true);
+}
+
+void TextEditor::EditorFindStatus() {
+    if (replacing_) {
+        statusmsg = "Replace " + query_ + " with: " + replacement_;
+        return;
+    }
+    if (regex_) {
+        EditorRegexStatus();
+        return;
+    }
+    statusmsg = "Search: " + query_;
+    if (scan_ != kNotFound || (match_ != kNotFound && !placed_)) {
+        statusmsg += "...";
+    } else if (match_ == kNotFound && !query_.empty()) {
+        statusmsg += " (not found)";
+    }
+}
+
+// Ctrl-R runs a regex over every line once Enter is pressed. The search
+// runs on worker threads over the text as it is, which cannot change until
+// the prompt is left, and matches show up as the chunks before them finish.
+// Esc stops a running search and keeps what it found; Down and Up step
+// through the matches, whether or not the search is still running.
+void TextEditor::EditorRegexKey(int symbol) {
+    switch (symbol) {
+        case '\x1b':
+            if (regex_scanning_) {
+                regex_search_.Stop();
+                regex_scanning_ = false;
+                EditorRegexPoll();
+            } else {
+                EditorFindLeave(true);
+            }
+            break;
+        case 13:
+            if (regex_ran_) {
+                EditorFindLeave(false);
+                break;
+            }
+            regex_ran_ = true;
+            regex_at_ = kNotFound;
+            match_ = kNotFound;
+            regex_matches_.clear();
+            regex_bad_ = !regex_search_.Start(query_, text_.TakeSnapshot());
+            regex_scanning_ = !regex_bad_;
+            break;
+        case CTRL_KEY('r'):
+        case ARROW_DOWN:
+        case ARROW_UP:
+            if (regex_at_ != kNotFound) {
+                size_t n = regex_matches_.size();
+                EditorRegexJump(symbol == ARROW_UP ? (regex_at_ + n - 1) % n : (regex_at_ + 1) % n);
+            }
+            break;
+        default:
+            if (!EditorQueryKey(symbol, query_)) {
+                EditorFindLeave(false);
+                EditorProcessKeypress(symbol);
+                return;
+            }
+            regex_search_.Stop();
+            regex_scanning_ = false;
+            regex_ran_ = false;
+            regex_bad_ = false;
+            regex_at_ = kNotFound;
+            match_ = kNotFound;
+            regex_matches_.clear();
+            break;
+    }
+    dirty_.assign(dirty_.size(), true);
+    if (searching_) {
+        EditorRegexStatus();
+    }
+}
+
+// Takes the matches of the chunks finished since the last poll. The cursor
+// goes to the first match after where the search started, or to the first
+// match at all once the search is over and there is none after it.
+void TextEditor::EditorRegexPoll() {
+    size_t from = regex_matches_.size();
+    if (regex_search_.Poll(regex_matches_) != 0) {
+        dirty_.assign(dirty_.size(), true);
+    }
+    if (regex_search_.Finished()) {
+        regex_search_.Wait();
+        regex_scanning_ = false;
+    }
+    if (regex_at_ == kNotFound) {
+        for (size_t i = from; i < regex_matches_.size(); ++i) {
+            if (regex_matches_[i].offset >= origin_) {
+                EditorRegexJump(i);
+                break;
+            }
+        }
+        if (regex_at_ == kNotFound && !regex_scanning_ && !regex_matches_.empty()) {
+            EditorRegexJump(0);
+        }
+    }
+    EditorRegexStatus();
+}
+
+// The cursor goes to the match the way it does for Ctrl-F, once the loader
+// has reached it.
+void TextEditor::EditorRegexJump(size_t i) {
+    regex_at_ = i;
+    match_ = regex_matches_[i].offset;
+    placed_ = false;
+    EditorFindPlace(false);
+}
+
+void TextEditor::EditorRegexStatus() {
+    statusmsg = "Regex: " + query_;
+    if (regex_bad_) {
+        statusmsg += " (bad pattern)";
+    } else if (regex_ran_) {
+        char buff[64];
+        size_t at = regex_at_ == kNotFound ? 0 : regex_at_ + 1;
+        int len = snprintf(buff, sizeof(buff), " %zu/%zu", at, regex_matches_.size());
+        if (regex_scanning_) {
+            len += snprintf(buff + len, sizeof(buff) - len, " %zu%%", regex_search_.Progress());
+        }
+        statusmsg.append(buff, len);
+    }
+}
+
+// Tab in either search prompt asks for a replacement, and Enter replaces
+// every match of the query in the file; Esc goes back to the search.
+void TextEditor::EditorReplaceKey(int symbol) {
+    if (symbol == '\x1b') {
+        replacing_ = false;
+    } else if (symbol == 13) {
+        EditorReplaceAll();
+        return;
+    } else {
+        EditorQueryKey(symbol, replacement_);
+    }
+    EditorFindStatus();
+}
+
+// A regex search still running is waited for, and one that was stopped or
+// never run is run to the end first. Its matches in lines searched in
+// windows may be wrong, so if there are any nothing is replaced.
+void TextEditor::EditorReplaceAll() {
+    std::vector<RegexSearch::Match> matches;
+    if (regex_) {
+        if (!regex_scanning_ && !(regex_ran_ && regex_search_.Finished())) {
+            regex_ran_ = true;
+            regex_matches_.clear();
+            regex_bad_ = !regex_search_.Start(query_, text_.TakeSnapshot());
+            regex_scanning_ = !regex_bad_;
+        }
+        if (regex_bad_) {
+            replacing_ = false;
+            EditorFindStatus();
+            return;
+        }
+        regex_search_.Wait();
+        regex_search_.Poll(regex_matches_);
+        regex_scanning_ = false;
+        if (regex_search_.Windowed()) {
+            replacing_ = false;
+            statusmsg = "not replaced: a match is in a line over 4 KB";
+            return;
+        }
+        matches.swap(regex_matches_);
+    } else if (!query_.empty()) {
+        size_t size = text_.Size();
+        size_t at = 0;
+        while (at < size) {
+            size_t to = std::min(size, at + kSearchSlice);
+            size_t found = text_.Find(query_, at, to);
+            if (found == kNotFound) {
+                at = to;
+                continue;
+            }
+            RegexSearch::Match match = {found, query_.size()};
+            matches.push_back(match);
+            at = found + query_.size();
+        }
+    }
+    EditorFindLeave(matches.empty());
+    statusmsg = "replaced " + std::to_string(matches.size());
+    ReplaceAll(std::move(matches), replacement_);
+}
+
 /*** input ***/
 
 void TextEditor::EditorMoveCursor(int key) {
@@ -606,11 +1999,16 @@ void TextEditor::EditorMoveCursor(int key) {
     }
 }
 
-void TextEditor::EditorProcessKeypress() {
-    int symbol = EditorReadKey();
+void TextEditor::EditorProcessKeypress(int symbol) {
+    statusmsg.clear();
+    if (searching_) {
+        EditorFindKey(symbol);
+        return;
+    }
 
     switch (symbol) {
         case CTRL_KEY('q'):
+            journal.Remove();
             write(STDOUT_FILENO, "\x1b[2J", 4);
             write(STDOUT_FILENO, "\x1b[H", 3);
             exit(0);
@@ -621,6 +2019,15 @@ void TextEditor::EditorProcessKeypress() {
         case CTRL_KEY('y'):
             Redo();
             break;
+        case CTRL_KEY('s'):
+            EditorSave();
+            break;
+        case CTRL_KEY('f'):
+            EditorFind(false);
+            break;
+        case CTRL_KEY('r'):
+            EditorFind(true);
+            break;
 
         case DEL_KEY:
             Delete();
@@ -630,7 +2037,7 @@ void TextEditor::EditorProcessKeypress() {
             cur_.x_ = 0;
             break;
         case END_KEY:
-            cur_.x_ = screencols - 1;
+            cur_.x_ = text_.LineLength(cur_.y_);
             break;
 
         case PAGE_UP:
@@ -655,24 +2062,123 @@ void TextEditor::EditorProcessKeypress() {
         case 127:
             BackSpace();
             break;
+        case PASTE_START:
+            {
+                std::string text;
+                input.TakePaste(text, newline_);
+                InsertText(text);
+            }
+            break;
         default:
             Type(symbol);
     }
 }
 
+void TextEditor::EditorResize() {
+    if (GetWindowSize(&screenrows, &screencols) == -1) {
+        die("GetWindowSize");
+    }
+    screenrows -= 1;
+    shadow_.clear();
+}
+
+// Waits for the next event, then handles every key that arrives before the
+// next frame is due, so a burst of input is drawn once per frame rather
+// than once per key. A continuous stream still gets a frame every interval.
+// A pending search scans until the frame is due and then only polls.
+void TextEditor::EditorProcessEvents() {
+    typedef std::chrono::steady_clock Clock;
+    bool journaled = journal.Commit(false);
+    Clock::time_point due = last_frame_ + frame_interval_;
+    int timeout = text_.Loading() || journal.Pending() ? kIdleTimeout : -1;
+    if (searching_ && scan_ != kNotFound) {
+        EditorFindStep(due);
+        timeout = 0;
+    } else if (searching_ && match_ != kNotFound && !placed_) {
+        EditorFindPlace(false);
+        EditorFindStatus();
+        timeout = placed_ ? 0 : kIdleTimeout;
+    }
+    if (searching_ && regex_scanning_) {
+        EditorRegexPoll();
+        timeout = kPollTimeout;
+    } else if (regex_search_.Reap() && (timeout < 0 || timeout > kPollTimeout)) {
+        timeout = kPollTimeout;
+    }
+    if (spell_.Enabled()) {
+        if (EditorSpellPoll()) {
+            timeout = 0;
+        } else if (spell_.Pending() && (timeout < 0 || timeout > kPollTimeout)) {
+            timeout = kPollTimeout;
+        }
+    }
+    int symbol = EditorReadKey(timeout);
+    Clock::time_point limit = std::max(due, Clock::now() + frame_interval_);
+    while (symbol != 0) {
+        EditorProcessKeypress(symbol);
+        Clock::time_point now = Clock::now();
+        if (now >= limit) {
+            break;
+        }
+        long left = std::chrono::duration_cast<std::chrono::milliseconds>(due - now).count();
+        symbol = EditorReadKey(left > 0 ? left : 0);
+    }
+    if (!journaled) {
+        statusmsg = std::string("journal stopped: ") + strerror(journal.Error());
+    }
+    if (window_resized) {
+        window_resized = 0;
+        EditorResize();
+    }
+}
+
 /*** init ***/
 
 TextEditor::TextEditor() {
+    newline_ = "\n";
+    was_empty_ = true;
+    ending_ = newline_;
+    welcome_ = false;
     rowoff = 0;
     coloff = 0;
-    text_.resize(1);
-    if (GetWindowSize(&screenrows, &screencols) == -1) {
-        die("GetWindowSize");
+    rx_ = 0;
+    searching_ = false;
+    regex_ = false;
+    regex_scanning_ = false;
+    replacing_ = false;
+    match_ = kNotFound;
+    placed_ = false;
+    scan_ = kNotFound;
+    spell_batch_ = false;
+    EditorResize();
+    show_frame_stats_ = getenv("TERM_EDITOR_FRAME_STATS") != nullptr;
+    frame_time_ = std::chrono::steady_clock::duration::zero();
+    frame_allocations_ = 0;
+    int fps = 60;
+    if (const char* cap = getenv("TERM_EDITOR_FPS")) {
+        fps = atoi(cap);
+    }
+    frame_interval_ = fps > 0 ? std::chrono::steady_clock::duration(std::chrono::seconds(1)) / fps
+                              : std::chrono::steady_clock::duration::zero();
+    if (const char* interval = getenv("TERM_EDITOR_FSYNC_MS")) {
+        char* end;
+        errno = 0;
+        long ms = strtol(interval, &end, 10);
+        if (end != interval && *end == '\0' && errno == 0 && ms >= 0) {
+            journal.SetInterval(std::chrono::milliseconds(ms));
+        } else {
+            statusmsg = "bad TERM_EDITOR_FSYNC_MS";
+        }
+    }
+    const char* dictionary = getenv("TERM_EDITOR_DICT");
+    if (dictionary && *dictionary != '\0' && access(dictionary, R_OK) == 0) {
+        spell_.Start(dictionary);
     }
 }
 
 int main(int argc, char *argv[]) {
     EnableRawMode();
+    EnableResizeSignal();
     TextEditor text;
     if (argc >= 2) {
         text.EditorOpen(argv[1]);
@@ -680,7 +2186,7 @@ int main(int argc, char *argv[]) {
 
     while (1) {
         text.EditorRefreshScreen();
-        text.EditorProcessKeypress();
+        text.EditorProcessEvents();
     }
     return 0;
 }
\ No newline at end of file
@@ -1,4 +1,5 @@
 #include <text_editor.h>
+#include <algorithm>
 
 bool Cursor::operator==(const Cursor& s) {
     return x_ == s.x_ && y_ == s.y_;
@@ -8,63 +9,109 @@ bool Cursor::operator!=(const Cursor& s) {
     return !(*this == s);
 }
 
-TypeAction::TypeAction(const char& symbol) : symbol_(symbol) {
+InsertRangeAction::InsertRangeAction(const Cursor& from, const Cursor& to, size_t length)
+    : from_(from), to_(to), length_(length) {
 }
 
-bool TypeAction::Do(TextEditor* text) {
-    text->Type(symbol_, cur_);
-    return true;
+const char* InsertRangeAction::Text() const {
+    return reinterpret_cast<const char*>(this + 1);
+}
+
+size_t InsertRangeAction::Length() const {
+    return length_;
 }
 
-bool DelAction::Do(TextEditor* text) {
-    symbol_ = text->Delete(cur_);
-    return symbol_ != '\0';
+bool InsertRangeAction::Continues(const Cursor& cursor) {
+    return to_ == cursor && Text()[length_ - 1] != '\n';
 }
 
-bool BackAction::Do(TextEditor* text) {
-    symbol_ = text->BackSpace(cur_);
-    return symbol_ != '\0';
+void InsertRangeAction::Append(const Cursor& to, size_t length) {
+    to_ = to;
+    length_ += length;
+}
+
+bool InsertRangeAction::Do(TextEditor* text) {
+    Cursor cursor = from_;
+    text->Type(Text(), length_, cursor);
+    return true;
 }
 
-bool NewLineAction::Do(TextEditor* text) {
-    text->PasteNewLine(cur_);
+bool InsertRangeAction::Undo(TextEditor* text) {
+    Cursor cursor = from_;
+    text->Erase(length_, cursor);
     return true;
 }
 
-bool TypeAction::Undo(TextEditor* text) {
-    symbol_ = text->BackSpace(cur_);
-    return symbol_ != '\0';
+DeleteRangeAction::DeleteRangeAction(const Cursor& at, size_t length, bool backward)
+    : at_(at), length_(length), backward_(backward) {
+}
+
+const char* DeleteRangeAction::Text() const {
+    return reinterpret_cast<const char*>(this + 1);
+}
+
+size_t DeleteRangeAction::Length() const {
+    return length_;
+}
+
+bool DeleteRangeAction::Continues(const Cursor& cursor, bool backward) {
+    return at_ == cursor && backward_ == backward && Text()[length_ - 1] != '\n';
+}
+
+void DeleteRangeAction::Append(const Cursor& at, size_t length) {
+    at_ = at;
+    length_ += length;
 }
 
-bool DelAction::Undo(TextEditor* text) {
-    text->Type(symbol_, cur_);
-    text->ShiftLeft();
-    cur_ = text->cur_;
+bool DeleteRangeAction::Do(TextEditor* text) {
+    Cursor cursor = at_;
+    text->Erase(length_, cursor);
     return true;
 }
 
-bool BackAction::Undo(TextEditor* text) {
-    text->Type(symbol_, cur_);
+bool DeleteRangeAction::Undo(TextEditor* text) {
+    Cursor cursor = at_;
+    if (backward_) {
+        std::string run(Text(), length_);
+        std::reverse(run.begin(), run.end());
+        text->Type(run.data(), length_, cursor);
+    } else {
+        text->Type(Text(), length_, cursor);
+        text->cur_ = at_;
+    }
     return true;
 }
 
-bool NewLineAction::Undo(TextEditor* text) {
-    text->ReverseNewLine(cur_);
+ReplaceRangeAction::ReplaceRangeAction(const Cursor& from, size_t removed, size_t inserted)
+    : from_(from), removed_(removed), inserted_(inserted) {
+}
+
+bool ReplaceRangeAction::Do(TextEditor* text) {
+    Cursor cursor = from_;
+    text->Erase(removed_, cursor);
+    text->Type(reinterpret_cast<const char*>(this + 1) + removed_, inserted_, cursor);
+    return true;
+}
+
+bool ReplaceRangeAction::Undo(TextEditor* text) {
+    Cursor cursor = from_;
+    text->Erase(inserted_, cursor);
+    text->Type(reinterpret_cast<const char*>(this + 1), removed_, cursor);
+    text->cur_ = from_;
     return true;
 }
 
 void IAction::Do(TextEditor* text) {
-    if (Descriptor.kDo(const_cast<char*>(OperStorage), text)) {
-        text->storage_.for_undo.push(this);
+    if (Descriptor->kDo(OperStorage(), text)) {
+        text->storage_.done_ += Size;
     } else {
-        delete this;
+        text->storage_.Truncate();
     }
 }
 
 void IAction::Undo(TextEditor* text) {
-    if (Descriptor.kUndo(const_cast<char*>(OperStorage), text)) {
-        text->storage_.for_redo.push(this);
-    } else {
-        delete this;
+    text->storage_.done_ -= Size;
+    if (!Descriptor->kUndo(OperStorage(), text)) {
+        text->storage_.Truncate();
     }
 }
\ No newline at end of file
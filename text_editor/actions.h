@@ -3,6 +3,7 @@
 #define TEXT_EDITOR_ACTIONS_H
 
 #include <cstddef>
+#include <type_traits>
 
 class TextEditor;
 
@@ -17,63 +18,76 @@ struct IActDescriptor {
     const char* UniqueAddr;
     bool (*kDo)(char*, TextEditor*);
     bool (*kUndo)(char*, TextEditor*);
-    void (*Destroyer)(char*);
 };
 
+template <typename TBaser>
+const IActDescriptor* Describe() {
+    static const char kUniqueVar = '\0';
+    static const IActDescriptor kDescriptor = {
+        &kUniqueVar,
+        [](char* f, TextEditor* text) -> bool { return (reinterpret_cast<TBaser*>(f))->Do(text); },
+        [](char* f, TextEditor* text) -> bool { return (reinterpret_cast<TBaser*>(f))->Undo(text); }};
+    return &kDescriptor;
+}
+
+// Header of a record in the undo log. The action itself follows it, padded
+// so that the next header stays aligned; Prev is the size of the record
+// before this one, which lets the log be walked in both directions.
 struct IAction {
-    IActDescriptor Descriptor;
-    char OperStorage[256 - sizeof(IActDescriptor)];
-    template <typename TBaser>
-    explicit IAction(TBaser r) {
-        static_assert(sizeof(TBaser) <= 256 - sizeof(IActDescriptor), "too large Base");
-        static const char kUniqueVar = '\0';
-        Descriptor.UniqueAddr = &kUniqueVar;
-        Descriptor.kDo = [](char* f, TextEditor* text) -> bool { return (reinterpret_cast<TBaser*>(f))->Do(text); };
-        Descriptor.kUndo = [](char* f, TextEditor* text) { return (reinterpret_cast<TBaser*>(f))->Undo(text); };
-        Descriptor.Destroyer = [](char* f) { (reinterpret_cast<TBaser*>(f))->~TBaser(); };
-        new (OperStorage) TBaser(r);
-    }
-    ~IAction() {
-        if (Descriptor.UniqueAddr) {
-            Descriptor.Destroyer(OperStorage);
-        }
+    const IActDescriptor* Descriptor;
+    size_t Size;
+    size_t Prev;
+    char* OperStorage() {
+        return reinterpret_cast<char*>(this + 1);
     }
     void Do(TextEditor*);
     void Undo(TextEditor*);
 };
 
-class TypeAction {
-    char symbol_;
-    Cursor cur_;
-
-public:
-    explicit TypeAction(const char&);
-    bool Do(TextEditor*);
-    bool Undo(TextEditor*);
-};
-
-class DelAction {
-    char symbol_;
-    Cursor cur_;
+// A run of text inserted or deleted at consecutive positions. The text
+// itself is stored in the undo log right after the action, and keystrokes
+// that continue the run are appended to it instead of starting a new record.
+class InsertRangeAction {
+    Cursor from_;
+    Cursor to_;
+    size_t length_;
 
 public:
+    InsertRangeAction(const Cursor&, const Cursor&, size_t);
+    const char* Text() const;
+    size_t Length() const;
+    bool Continues(const Cursor&);
+    void Append(const Cursor&, size_t);
     bool Do(TextEditor*);
     bool Undo(TextEditor*);
 };
 
-class BackAction {
-    char symbol_;
-    Cursor cur_;
+// A backward run (BackSpace) keeps its text in the order it was deleted,
+// so at_ is where the run ends and undo restores it reversed.
+class DeleteRangeAction {
+    Cursor at_;
+    size_t length_;
+    bool backward_;
 
 public:
+    DeleteRangeAction(const Cursor&, size_t, bool);
+    const char* Text() const;
+    size_t Length() const;
+    bool Continues(const Cursor&, bool);
+    void Append(const Cursor&, size_t);
     bool Do(TextEditor*);
     bool Undo(TextEditor*);
 };
 
-class NewLineAction {
-    Cursor cur_;
+// Replaces a range with new text as one undo step. The tail holds the
+// removed text followed by the inserted one.
+class ReplaceRangeAction {
+    Cursor from_;
+    size_t removed_;
+    size_t inserted_;
 
 public:
+    ReplaceRangeAction(const Cursor&, size_t, size_t);
     bool Do(TextEditor*);
     bool Undo(TextEditor*);
 };
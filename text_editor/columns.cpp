@@ -0,0 +1,227 @@
+#include "columns.h"
+
+#include <algorithm>
+#include "utf8.h"
+
+namespace {
+
+const size_t kNoLine = static_cast<size_t>(-1);
+
+size_t Width(uint32_t code, size_t column) {
+    if (code == '\t') {
+        return ColumnIndex::kTabStop - column % ColumnIndex::kTabStop;
+    }
+    if (IsCombining(code)) {
+        return 0;
+    }
+    return IsWide(code) ? 2 : 1;
+}
+
+bool Printable(uint32_t code, size_t len) {
+    if (len == 1 && code == kReplacement) {
+        return false;
+    }
+    return code >= 0x20 && code != 0x7f && (code < 0x80 || code >= 0xa0);
+}
+
+}  // namespace
+
+const size_t ColumnIndex::kTabStop;
+const size_t ColumnIndex::kCheckpoint;
+const size_t ColumnIndex::kCachedLines;
+const size_t ColumnIndex::kChunk;
+
+ColumnIndex::ColumnIndex() : cache_(kCachedLines), buf_from_(0), buf_line_(kNoLine), start_(0), length_(0) {
+}
+
+void ColumnIndex::Clear() {
+    for (Entry& entry : cache_) {
+        entry.valid = false;
+    }
+    buf_line_ = kNoLine;
+}
+
+// An edit from byte x of line to line last, numbered as after it, that
+// added (lines > 0) or removed line breaks. Checkpoints before x still
+// hold, since nothing before x has moved.
+void ColumnIndex::Edit(size_t line, size_t x, size_t last, long lines) {
+    buf_line_ = kNoLine;
+    for (Entry& entry : cache_) {
+        if (entry.valid && entry.line == line) {
+            while (entry.points.size() > 1 && entry.points.back().byte >= x) {
+                entry.points.pop_back();
+            }
+        } else if ((lines != 0 || entry.line <= last) && entry.line > line) {
+            entry.valid = false;
+        }
+    }
+}
+
+size_t ColumnIndex::Column(PieceTable& text, size_t y, size_t x) {
+    Char c = Seek(text, y, x, kNoLine);
+    return x == c.at.byte ? c.at.column : c.next.column;
+}
+
+size_t ColumnIndex::Byte(PieceTable& text, size_t y, size_t column) {
+    return Seek(text, y, kNoLine, column).at.byte;
+}
+
+size_t ColumnIndex::Next(PieceTable& text, size_t y, size_t x) {
+    return Seek(text, y, x, kNoLine).next.byte;
+}
+
+size_t ColumnIndex::Prev(PieceTable& text, size_t y, size_t x) {
+    return x == 0 ? 0 : Seek(text, y, x - 1, kNoLine).at.byte;
+}
+
+ColumnIndex::Cells ColumnIndex::Window(PieceTable& text, size_t y, size_t column, size_t width) {
+    Char first = Seek(text, y, kNoLine, column);
+    Cells cells = {first.at.byte, first.at.byte, first.at.column};
+    if (width != 0) {
+        cells.end = Seek(text, y, kNoLine, column + width - 1).next.byte;
+    }
+    return cells;
+}
+
+void ColumnIndex::Expand(const char* s, size_t n, size_t& at, size_t from, size_t to, std::string& out) {
+    size_t i = 0;
+    while (i < n) {
+        size_t run = PlainPrefix(s + i, n - i);
+        if (run != 0) {
+            size_t lo = std::max(at, from);
+            size_t hi = std::min(at + run, to);
+            if (lo < hi) {
+                out.append(s + i + (lo - at), hi - lo);
+            }
+            at += run;
+            i += run;
+            continue;
+        }
+        uint32_t code;
+        size_t len = DecodeUtf8(s + i, n - i, code);
+        size_t width = Width(code, at);
+        if (width == 0 && at == 0) {
+            width = 1;
+        }
+        if (width == 0) {
+            if (at > from && at <= to) {
+                out.append(s + i, len);
+            }
+        } else if (at >= from && at + width <= to) {
+            if (code == '\t') {
+                out.append(width, ' ');
+            } else if (!Printable(code, len)) {
+                out += '?';
+            } else if (IsCombining(code)) {
+                out += ' ';
+                out.append(s + i, len);
+            } else {
+                out.append(s + i, len);
+            }
+        } else if (at + width > from && at < to) {
+            out.append(std::min(at + width, to) - std::max(at, from), ' ');
+        }
+        at += width;
+        i += len;
+    }
+}
+
+ColumnIndex::Entry& ColumnIndex::Get(PieceTable& text, size_t y) {
+    Entry& entry = cache_[y % kCachedLines];
+    if (!entry.valid || entry.line != y) {
+        Point origin = {0, 0};
+        entry.line = y;
+        entry.valid = true;
+        entry.points.assign(1, origin);
+    }
+    if (buf_line_ != y) {
+        buf_line_ = y;
+        start_ = text.LineStart(y);
+        length_ = text.LineLength(y);
+        buf_.clear();
+        buf_from_ = 0;
+    }
+    return entry;
+}
+
+// The last character that starts at or before both byte and column, and
+// where the one after it starts. The end of the line counts as a character
+// that starts there and has no width.
+ColumnIndex::Char ColumnIndex::Seek(PieceTable& text, size_t y, size_t byte, size_t column) {
+    std::vector<Point>& points = Get(text, y).points;
+    size_t lo = 1;
+    size_t hi = points.size();
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (points[mid].byte <= byte && points[mid].column <= column) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    Point at = points[lo - 1];
+    while (at.byte < length_) {
+        size_t avail;
+        const char* p = Read(text, at.byte, avail);
+        size_t run = *p >= 0x20 && *p < 0x7f ? PlainPrefix(p, avail) : 0;
+        // Every byte of a printable ASCII run but the last is a character
+        // of width one that nothing combines with.
+        size_t steps = run < 2 ? 0 : std::min(run - 1, std::min(byte - at.byte, column - at.column));
+        if (steps != 0) {
+            size_t mark;
+            while ((mark = points.back().column + kCheckpoint) <= at.column + steps) {
+                Point point = {at.byte + (mark - at.column), mark};
+                points.push_back(point);
+            }
+            at.byte += steps;
+            at.column += steps;
+            continue;
+        }
+        Point next = After(text, at);
+        if (next.byte > byte || next.column > column) {
+            Char c = {at, next};
+            return c;
+        }
+        at = next;
+        if (at.byte < length_ && at.column >= points.back().column + kCheckpoint) {
+            points.push_back(at);
+        }
+    }
+    Char c = {at, at};
+    return c;
+}
+
+// Line bytes from pos on, refilled a chunk at a time so that a whole UTF-8
+// sequence starting at pos is always available.
+const char* ColumnIndex::Read(PieceTable& text, size_t pos, size_t& avail) {
+    size_t end = buf_from_ + buf_.size();
+    if (pos < buf_from_ || pos >= end || (pos + kUtf8Max > end && end < length_)) {
+        buf_from_ = pos;
+        buf_.clear();
+        text.Copy(start_ + pos, std::min(kChunk, length_ - pos), buf_);
+        end = buf_from_ + buf_.size();
+    }
+    avail = end - pos;
+    return buf_.data() + (pos - buf_from_);
+}
+
+// Where the character after the one starting at at begins.
+ColumnIndex::Point ColumnIndex::After(PieceTable& text, Point at) {
+    size_t avail;
+    const char* p = Read(text, at.byte, avail);
+    uint32_t code;
+    size_t len = DecodeUtf8(p, avail, code);
+    Point next = {at.byte + len, at.column + std::max<size_t>(Width(code, at.column), 1)};
+    while (next.byte < length_) {
+        p = Read(text, next.byte, avail);
+        if (static_cast<unsigned char>(*p) < 0xcc) {
+            break;
+        }
+        len = DecodeUtf8(p, avail, code);
+        if (!IsCombining(code)) {
+            break;
+        }
+        next.byte += len;
+    }
+    return next;
+}
@@ -0,0 +1,82 @@
+#ifndef TEXT_EDITOR_COLUMNS_H
+#define TEXT_EDITOR_COLUMNS_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "piece_table.h"
+
+// Maps byte offsets in a line to screen columns and back. A character is a
+// code point together with the combining marks after it; it takes two
+// columns when it is wide, a tab runs to the next multiple of kTabStop, and
+// anything else takes one column.
+//
+// Each line keeps checkpoints, the byte offset and column of a character,
+// about every kCheckpoint columns, so a query decodes at most that many
+// columns from the nearest checkpoint before it. Checkpoints are found as
+// queries reach them, runs of printable ASCII are skipped a vector at a
+// time, and an edit only drops the checkpoints after its position. Indexes
+// of recently used lines are cached by line number.
+class ColumnIndex {
+public:
+    static const size_t kTabStop = 8;
+    static const size_t kCheckpoint = 256;
+
+    // Bytes [begin, end) of a line hold the characters that cover some
+    // range of columns; the first of them starts at column.
+    struct Cells {
+        size_t begin;
+        size_t end;
+        size_t column;
+    };
+
+    ColumnIndex();
+
+    void Clear();
+    void Edit(size_t line, size_t x, size_t last, long lines);
+    size_t Column(PieceTable& text, size_t y, size_t x);
+    size_t Byte(PieceTable& text, size_t y, size_t column);
+    size_t Next(PieceTable& text, size_t y, size_t x);
+    size_t Prev(PieceTable& text, size_t y, size_t x);
+    Cells Window(PieceTable& text, size_t y, size_t column, size_t width);
+
+    // Appends what bytes s[0, n), drawn from column at on, put in columns
+    // [from, to), and moves at past them. Tabs become spaces, control
+    // characters and malformed bytes '?', and a character cut by either
+    // edge is drawn as spaces.
+    static void Expand(const char* s, size_t n, size_t& at, size_t from, size_t to, std::string& out);
+
+private:
+    struct Point {
+        size_t byte;
+        size_t column;
+    };
+
+    struct Char {
+        Point at;
+        Point next;
+    };
+
+    struct Entry {
+        size_t line;
+        bool valid;
+        std::vector<Point> points;
+    };
+
+    static const size_t kCachedLines = 256;
+    static const size_t kChunk = 1 << 14;
+
+    std::vector<Entry> cache_;
+    std::string buf_;
+    size_t buf_from_;
+    size_t buf_line_;
+    size_t start_;
+    size_t length_;
+
+    Entry& Get(PieceTable& text, size_t y);
+    Char Seek(PieceTable& text, size_t y, size_t byte, size_t column);
+    const char* Read(PieceTable& text, size_t pos, size_t& avail);
+    Point After(PieceTable& text, Point at);
+};
+
+#endif  // TEXT_EDITOR_COLUMNS_H
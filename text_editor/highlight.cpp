@@ -0,0 +1,280 @@
+#include "highlight.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+
+// Both tables are sorted for binary search.
+static const char* const kKeywords[] = {
+    "break", "case", "catch", "class", "const", "constexpr", "continue", "default", "delete", "do",
+    "else", "enum", "explicit", "false", "for", "friend", "goto", "if", "inline", "namespace", "new",
+    "noexcept", "nullptr", "operator", "override", "private", "protected", "public", "return", "sizeof",
+    "static", "static_assert", "struct", "switch", "template", "this", "throw", "true", "try", "typedef",
+    "typename", "union", "using", "virtual", "volatile", "while"};
+
+static const char* const kTypes[] = {
+    "auto", "bool", "char", "double", "float", "int", "int64_t", "long", "short", "signed",
+    "size_t", "uint32_t", "uint64_t", "uint8_t", "unsigned", "void"};
+
+static bool Find(const char* const* begin, const char* const* end, const char* word, size_t n) {
+    const char* const* it = std::lower_bound(begin, end, word, [n](const char* entry, const char* w) {
+        return strncmp(entry, w, n) < 0;
+    });
+    return it != end && strncmp(*it, word, n) == 0 && (*it)[n] == '\0';
+}
+
+static Highlighter::Style WordStyle(const char* word, size_t n) {
+    if (Find(std::begin(kKeywords), std::end(kKeywords), word, n)) {
+        return Highlighter::kKeyword;
+    }
+    if (Find(std::begin(kTypes), std::end(kTypes), word, n)) {
+        return Highlighter::kType;
+    }
+    return Highlighter::kNormal;
+}
+
+static bool IsWord(char c) {
+    return isalnum(static_cast<unsigned char>(c)) || c == '_';
+}
+
+static void Add(std::vector<Highlighter::Span>& spans, size_t start, size_t length, Highlighter::Style style) {
+    if (!spans.empty() && spans.back().style == style && spans.back().start + spans.back().length == start) {
+        spans.back().length += length;
+    } else {
+        Highlighter::Span span = {start, length, style};
+        spans.push_back(span);
+    }
+}
+
+const size_t Highlighter::kCachedLines;
+const size_t Highlighter::kRelexChunk;
+
+Highlighter::Highlighter() : enabled_(false), valid_(0), edited_(0), cache_(kCachedLines) {
+}
+
+bool Highlighter::Supports(const std::string& filename) {
+    static const char* const kExtensions[] = {".c", ".cc", ".cpp", ".cxx", ".h", ".hh", ".hpp"};
+    size_t dot = filename.rfind('.');
+    if (dot == std::string::npos) {
+        return false;
+    }
+    for (const char* ext : kExtensions) {
+        if (filename.compare(dot, std::string::npos, ext) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void Highlighter::Enable(bool enabled) {
+    enabled_ = enabled;
+    states_.clear();
+    valid_ = 0;
+    edited_ = 0;
+    for (Entry& entry : cache_) {
+        entry.valid = false;
+    }
+}
+
+bool Highlighter::Enabled() const {
+    return enabled_;
+}
+
+// An edit to lines [line, last], numbered as they are after it, that added
+// (lines > 0) or removed line breaks. The cached end state of the old last
+// line stays on the new last line, since that is the state the lines after
+// it were lexed with.
+void Highlighter::Edit(size_t line, size_t last, long lines) {
+    if (!enabled_) {
+        return;
+    }
+    if (line < states_.size()) {
+        if (lines > 0) {
+            states_.insert(states_.begin() + line, lines, kCode);
+        } else if (lines < 0 && line - lines < states_.size()) {
+            states_.erase(states_.begin() + line, states_.begin() + line - lines);
+        } else if (lines < 0) {
+            states_.resize(line);
+        }
+    }
+    if (edited_ > line) {
+        edited_ = lines < 0 && edited_ - line < static_cast<size_t>(-lines) ? line : edited_ + lines;
+    }
+    edited_ = std::max(edited_, last);
+    valid_ = std::min(valid_, line);
+    for (Entry& entry : cache_) {
+        if ((entry.line >= line && entry.line <= last) || (lines != 0 && entry.line > line)) {
+            entry.valid = false;
+        }
+    }
+}
+
+// Whether line y, as it is now, ends inside a block comment.
+bool Highlighter::EndsInComment(PieceTable& text, size_t y) {
+    Relex(text, y);
+    line_.clear();
+    text.Copy(text.LineStart(y), text.LineLength(y), line_);
+    return EndState(line_.data(), line_.size(), StartState(y)) == kBlockComment;
+}
+
+const std::vector<Highlighter::Span>& Highlighter::Spans(PieceTable& text, size_t y) {
+    Relex(text, y);
+    Entry& entry = cache_[y % kCachedLines];
+    State start = StartState(y);
+    if (entry.valid && entry.line == y && entry.start == start) {
+        return entry.spans;
+    }
+    line_.clear();
+    text.Copy(text.LineStart(y), text.LineLength(y), line_);
+    entry.spans.clear();
+    Store(y, Lex(line_, start, entry.spans));
+    entry.line = y;
+    entry.valid = true;
+    entry.start = start;
+    return entry.spans;
+}
+
+Highlighter::State Highlighter::StartState(size_t y) const {
+    return y == 0 ? kCode : static_cast<State>(states_[y - 1]);
+}
+
+// Lines before to are read a chunk at a time rather than looked up one by
+// one; a line longer than a chunk is read on its own.
+void Highlighter::Relex(PieceTable& text, size_t to) {
+    while (valid_ < to) {
+        size_t pos = text.LineStart(valid_);
+        size_t end = text.LineStart(to);
+        line_.clear();
+        text.Copy(pos, std::min(kRelexChunk, end - pos), line_);
+        const char* data = line_.data();
+        const char* stop = data + line_.size();
+        size_t y = valid_;
+        while (y == valid_ && y < to) {
+            const char* nl = static_cast<const char*>(memchr(data, '\n', stop - data));
+            if (nl == nullptr && data != line_.data()) {
+                break;
+            }
+            if (nl == nullptr) {
+                line_.clear();
+                text.Copy(pos, text.LineLength(y), line_);
+                Store(y, EndState(line_.data(), line_.size(), StartState(y)));
+                break;
+            }
+            Store(y, EndState(data, nl - data, StartState(y)));
+            pos += nl + 1 - data;
+            data = nl + 1;
+            ++y;
+        }
+    }
+}
+
+// Records the end state of line y once the states before it are valid.
+void Highlighter::Store(size_t y, State end) {
+    if (y != valid_) {
+        return;
+    }
+    ++valid_;
+    if (y == states_.size()) {
+        states_.push_back(end);
+        return;
+    }
+    bool converged = y >= edited_ && states_[y] == end;
+    states_[y] = end;
+    if (converged) {
+        valid_ = states_.size();
+        edited_ = 0;
+    } else if (y >= edited_) {
+        edited_ = y + 1;
+    }
+}
+
+// The state Lex would end in, found without lexing words and numbers, since
+// neither can hold a quote or a slash.
+Highlighter::State Highlighter::EndState(const char* s, size_t n, State state) const {
+    size_t i = 0;
+    while (i < n) {
+        if (state == kBlockComment) {
+            const char* star = static_cast<const char*>(memchr(s + i, '*', n - i));
+            if (star == nullptr || star + 1 == s + n) {
+                break;
+            }
+            i = star + 1 - s;
+            if (s[i] == '/') {
+                ++i;
+                state = kCode;
+            }
+            continue;
+        }
+        while (i < n && s[i] != '/' && s[i] != '"' && s[i] != '\'') {
+            ++i;
+        }
+        if (i == n) {
+            break;
+        }
+        char c = s[i++];
+        if (c == '/') {
+            if (i < n && s[i] == '/') {
+                break;
+            }
+            if (i < n && s[i] == '*') {
+                ++i;
+                state = kBlockComment;
+            }
+        } else {
+            while (i < n && s[i] != c) {
+                i += s[i] == '\\' ? 2 : 1;
+            }
+            i = std::min(i + 1, n);
+        }
+    }
+    return state;
+}
+
+Highlighter::State Highlighter::Lex(const std::string& s, State state, std::vector<Span>& spans) const {
+    size_t n = s.size();
+    size_t i = 0;
+    while (i < n) {
+        size_t start = i;
+        if (state == kBlockComment) {
+            size_t end = s.find("*/", i);
+            i = end == std::string::npos ? n : end + 2;
+            state = end == std::string::npos ? kBlockComment : kCode;
+            Add(spans, start, i - start, kComment);
+            continue;
+        }
+        char c = s[i];
+        if (c == '/' && i + 1 < n && s[i + 1] == '/') {
+            Add(spans, start, n - start, kComment);
+            break;
+        }
+        if (c == '/' && i + 1 < n && s[i + 1] == '*') {
+            i += 2;
+            state = kBlockComment;
+            Add(spans, start, i - start, kComment);
+        } else if (c == '"' || c == '\'') {
+            ++i;
+            while (i < n && s[i] != c) {
+                i += s[i] == '\\' ? 2 : 1;
+            }
+            i = std::min(i + 1, n);
+            Add(spans, start, i - start, kString);
+        } else if (isdigit(static_cast<unsigned char>(c))) {
+            while (i < n && (IsWord(s[i]) || s[i] == '.')) {
+                ++i;
+            }
+            Add(spans, start, i - start, kNumber);
+        } else if (IsWord(c) || c == '#') {
+            ++i;
+            while (i < n && IsWord(s[i])) {
+                ++i;
+            }
+            Style style = c == '#' ? kKeyword : WordStyle(s.data() + start, i - start);
+            if (style != kNormal) {
+                Add(spans, start, i - start, style);
+            }
+        } else {
+            ++i;
+        }
+    }
+    return state;
+}
@@ -0,0 +1,72 @@
+#ifndef TEXT_EDITOR_HIGHLIGHT_H
+#define TEXT_EDITOR_HIGHLIGHT_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "piece_table.h"
+
+// Syntax highlighting for C-like sources. The only state a line hands over
+// to the next is whether it ends inside a block comment, so the lexer state
+// at the end of every line lexed so far is kept in states_, one byte each.
+// States of lines [0, valid_) are known to be right. An edit moves valid_
+// back to the edited line, and relexing stops as soon as a line past the
+// edit ends in the same state it had before; the cached states after it
+// still hold. Spans of recently drawn lines are cached by line number.
+class Highlighter {
+public:
+    enum Style : unsigned char {
+        kNormal,
+        kComment,
+        kKeyword,
+        kType,
+        kString,
+        kNumber
+    };
+
+    struct Span {
+        size_t start;
+        size_t length;
+        Style style;
+    };
+
+    Highlighter();
+
+    static bool Supports(const std::string& filename);
+    void Enable(bool);
+    bool Enabled() const;
+    void Edit(size_t line, size_t last, long lines);
+    bool EndsInComment(PieceTable& text, size_t y);
+    const std::vector<Span>& Spans(PieceTable& text, size_t y);
+
+private:
+    enum State : unsigned char {
+        kCode,
+        kBlockComment
+    };
+
+    struct Entry {
+        size_t line;
+        bool valid;
+        State start;
+        std::vector<Span> spans;
+    };
+
+    static const size_t kCachedLines = 256;
+    static const size_t kRelexChunk = 1 << 16;
+
+    bool enabled_;
+    std::vector<unsigned char> states_;
+    size_t valid_;
+    size_t edited_;
+    std::vector<Entry> cache_;
+    std::string line_;
+
+    State Lex(const std::string&, State, std::vector<Span>&) const;
+    State EndState(const char*, size_t, State) const;
+    State StartState(size_t) const;
+    void Store(size_t, State);
+    void Relex(PieceTable& text, size_t to);
+};
+
+#endif  // TEXT_EDITOR_HIGHLIGHT_H
@@ -0,0 +1,266 @@
+#include "journal.h"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// The header ties a journal to the exact file it was recorded against;
+// records are a tag ('+' insert, '-' erase) followed by varint offset and
+// length, the inserted bytes for '+', and the CRC-32 of all of that, so
+// neither a torn write nor garbage left by a crash replays as an edit.
+static const char kMagic[4] = {'T', 'E', 'J', '2'};
+static const size_t kHeader = sizeof(kMagic) + 4 * sizeof(uint64_t);
+
+static std::string Stamp(const std::string& file) {
+    std::string header(kMagic, sizeof(kMagic));
+    struct stat st;
+    uint64_t fields[4] = {0, 0, 0, 0};
+    if (stat(file.c_str(), &st) == 0) {
+        fields[0] = st.st_size;
+        fields[1] = st.st_ino;
+        fields[2] = st.st_mtim.tv_sec;
+        fields[3] = st.st_mtim.tv_nsec;
+    }
+    header.append(reinterpret_cast<const char*>(fields), sizeof(fields));
+    return header;
+}
+
+struct CrcTable {
+    uint32_t entries[256];
+
+    CrcTable() {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k) {
+                c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            }
+            entries[i] = c;
+        }
+    }
+};
+
+static uint32_t Crc32(const char* data, size_t n) {
+    static const CrcTable table;
+    uint32_t crc = 0xffffffffu;
+    for (size_t i = 0; i < n; ++i) {
+        crc = table.entries[(crc ^ static_cast<unsigned char>(data[i])) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static void PutVarint(std::string& out, size_t value) {
+    while (value >= 0x80) {
+        out += static_cast<char>(value | 0x80);
+        value >>= 7;
+    }
+    out += static_cast<char>(value);
+}
+
+static bool GetVarint(const std::string& in, size_t& pos, size_t& value) {
+    value = 0;
+    for (int shift = 0; pos < in.size() && shift < 64; shift += 7) {
+        unsigned char byte = in[pos++];
+        value |= static_cast<size_t>(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool WriteAll(int fd, const char* data, size_t n) {
+    while (n != 0) {
+        ssize_t written = write(fd, data, n);
+        if (written == -1 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return false;
+        }
+        data += written;
+        n -= written;
+    }
+    return true;
+}
+
+Journal::Journal() : fd_(-1), error_(0), interval_(1000) {
+}
+
+Journal::~Journal() {
+    Commit(true);
+    if (fd_ != -1) {
+        close(fd_);
+    }
+}
+
+void Journal::SetInterval(std::chrono::milliseconds interval) {
+    interval_ = interval;
+}
+
+// Creates the journal, headed by the stamp of the file as it was opened or
+// last saved.
+bool Journal::Start() {
+    fd_ = open(path_.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_APPEND, 0600);
+    return fd_ != -1 && WriteAll(fd_, header_.data(), header_.size()) && fdatasync(fd_) == 0;
+}
+
+// Replays a journal left by an earlier session onto text when it was
+// recorded against the file as it is now, up to the first record that is
+// torn or fails its checksum, and keeps appending to it. A journal with
+// nothing to replay is removed. Returns the number of edits replayed.
+size_t Journal::Open(const std::string& file, PieceTable& text) {
+    path_ = file + ".journal";
+    header_ = Stamp(file);
+    synced_ = std::chrono::steady_clock::now();
+    fd_ = open(path_.c_str(), O_RDWR | O_APPEND);
+    if (fd_ == -1) {
+        if (errno != ENOENT) {
+            error_ = errno;
+            path_.clear();
+        }
+        return 0;
+    }
+    std::string log;
+    char buff[1 << 16];
+    ssize_t n;
+    while ((n = read(fd_, buff, sizeof(buff))) > 0) {
+        log.append(buff, n);
+    }
+    size_t replayed = 0;
+    size_t valid = 0;
+    if (log.size() >= kHeader && log.compare(0, kHeader, header_) == 0) {
+        size_t pos = kHeader;
+        valid = pos;
+        size_t offset;
+        size_t length;
+        while (pos < log.size()) {
+            size_t start = pos;
+            char tag = log[pos++];
+            if ((tag != '+' && tag != '-') || !GetVarint(log, pos, offset) || !GetVarint(log, pos, length)) {
+                break;
+            }
+            size_t payload = tag == '+' ? length : 0;
+            uint32_t crc;
+            if (payload > log.size() - pos || sizeof(crc) > log.size() - pos - payload) {
+                break;
+            }
+            memcpy(&crc, log.data() + pos + payload, sizeof(crc));
+            if (crc != Crc32(log.data() + start, pos + payload - start)) {
+                break;
+            }
+            if (tag == '+') {
+                if (offset > text.Size()) {
+                    break;
+                }
+                text.Insert(offset, log.data() + pos, length);
+            } else {
+                if (offset > text.Size() || length > text.Size() - offset) {
+                    break;
+                }
+                text.Erase(offset, length);
+            }
+            pos += payload + sizeof(crc);
+            valid = pos;
+            ++replayed;
+        }
+    }
+    if (replayed == 0) {
+        close(fd_);
+        fd_ = -1;
+        unlink(path_.c_str());
+    } else if (valid != log.size() && ftruncate(fd_, valid) != 0) {
+        Fail();
+    }
+    return replayed;
+}
+
+void Journal::Record(char tag, size_t offset, size_t length, const char* s, size_t n) {
+    size_t start = pending_.size();
+    pending_ += tag;
+    PutVarint(pending_, offset);
+    PutVarint(pending_, length);
+    pending_.append(s, n);
+    uint32_t crc = Crc32(pending_.data() + start, pending_.size() - start);
+    pending_.append(reinterpret_cast<const char*>(&crc), sizeof(crc));
+}
+
+void Journal::Insert(size_t offset, const char* s, size_t n) {
+    if (!path_.empty() && error_ == 0) {
+        Record('+', offset, n, s, n);
+    }
+}
+
+void Journal::Erase(size_t offset, size_t n) {
+    if (!path_.empty() && error_ == 0) {
+        Record('-', offset, n, nullptr, 0);
+    }
+}
+
+bool Journal::Pending() const {
+    return !pending_.empty();
+}
+
+// Returns false when the write failed just now. Journaling stops then,
+// since later records would follow a torn one, and the records written
+// before stay for recovery.
+bool Journal::Commit(bool force) {
+    if (pending_.empty()) {
+        return true;
+    }
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if (!force && now - synced_ < interval_) {
+        return true;
+    }
+    bool ok = (fd_ != -1 || Start()) && WriteAll(fd_, pending_.data(), pending_.size()) && fdatasync(fd_) == 0;
+    if (!ok) {
+        Fail();
+    }
+    pending_.clear();
+    synced_ = now;
+    return ok;
+}
+
+// The errno of the failure that stopped journaling, 0 while it runs.
+int Journal::Error() const {
+    return error_;
+}
+
+void Journal::Fail() {
+    error_ = errno != 0 ? errno : EIO;
+    pending_.clear();
+    if (fd_ != -1) {
+        close(fd_);
+        fd_ = -1;
+    }
+}
+
+// Called after the file was saved: the edits so far are in the file, so
+// the journal goes, and the next edit starts one against its new state.
+void Journal::Reset(const std::string& file) {
+    if (error_ != 0) {
+        Remove();
+        return;
+    }
+    pending_.clear();
+    if (fd_ != -1) {
+        close(fd_);
+        fd_ = -1;
+        unlink(path_.c_str());
+    }
+    header_ = Stamp(file);
+}
+
+void Journal::Remove() {
+    pending_.clear();
+    if (fd_ != -1) {
+        close(fd_);
+        fd_ = -1;
+    }
+    if (!path_.empty()) {
+        unlink(path_.c_str());
+        path_.clear();
+    }
+}
@@ -0,0 +1,45 @@
+#ifndef TEXT_EDITOR_JOURNAL_H
+#define TEXT_EDITOR_JOURNAL_H
+
+#include <chrono>
+#include <cstddef>
+#include <string>
+#include "piece_table.h"
+
+// Write-ahead log of the edits made to a file since it was last saved,
+// kept next to it as <file>.journal. Records are collected in memory and
+// group-committed: written and fdatasync'ed together at most once per
+// interval, so the edit loop never waits on the disk per keystroke. The
+// journal is created by the first commit after an open or a save, so it
+// exists only while there are edits to recover.
+class Journal {
+    int fd_;
+    std::string path_;
+    std::string header_;
+    std::string pending_;
+    int error_;
+    std::chrono::steady_clock::time_point synced_;
+    std::chrono::milliseconds interval_;
+
+    void Record(char, size_t, size_t, const char*, size_t);
+    bool Start();
+    void Fail();
+
+public:
+    Journal();
+    Journal(const Journal&) = delete;
+    Journal& operator=(const Journal&) = delete;
+    ~Journal();
+
+    void SetInterval(std::chrono::milliseconds);
+    size_t Open(const std::string& file, PieceTable& text);
+    void Insert(size_t, const char*, size_t);
+    void Erase(size_t, size_t);
+    bool Pending() const;
+    bool Commit(bool force);
+    int Error() const;
+    void Reset(const std::string& file);
+    void Remove();
+};
+
+#endif  // TEXT_EDITOR_JOURNAL_H
@@ -0,0 +1,94 @@
+#include "line_scan.h"
+
+#include <algorithm>
+#include <thread>
+
+#if defined(__GNUC__) && defined(__SSE2__)
+#include <immintrin.h>
+#define LINE_SCAN_X86
+#endif
+
+namespace {
+
+void ScanScalar(const char* data, size_t from, size_t to, size_t base, std::vector<size_t>& out) {
+    for (size_t i = from; i < to; ++i) {
+        if (data[i] == '\n') {
+            out.push_back(base + i);
+        }
+    }
+}
+
+#ifdef LINE_SCAN_X86
+size_t ScanSse2(const char* data, size_t n, size_t base, std::vector<size_t>& out) {
+    const __m128i nl = _mm_set1_epi8('\n');
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, nl));
+        while (mask) {
+            out.push_back(base + i + __builtin_ctz(mask));
+            mask &= mask - 1;
+        }
+    }
+    return i;
+}
+
+__attribute__((target("avx2"))) size_t ScanAvx2(const char* data, size_t n, size_t base, std::vector<size_t>& out) {
+    const __m256i nl = _mm256_set1_epi8('\n');
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        unsigned mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, nl));
+        while (mask) {
+            out.push_back(base + i + __builtin_ctz(mask));
+            mask &= mask - 1;
+        }
+    }
+    return i;
+}
+#endif
+
+}  // namespace
+
+void ScanNewlines(const char* data, size_t n, size_t base, std::vector<size_t>& out) {
+    size_t i = 0;
+#ifdef LINE_SCAN_X86
+    static const bool avx2 = (__builtin_cpu_init(), __builtin_cpu_supports("avx2"));
+    i = avx2 ? ScanAvx2(data, n, base, out) : ScanSse2(data, n, base, out);
+#endif
+    ScanScalar(data, i, n, base, out);
+}
+
+void ScanNewlinesParallel(const char* data, size_t n, size_t base, std::vector<size_t>& out) {
+    if (n < kParallelScan) {
+        ScanNewlines(data, n, base, out);
+        return;
+    }
+    static const size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    if (threads == 1) {
+        ScanNewlines(data, n, base, out);
+        return;
+    }
+    size_t chunk = (n + threads - 1) / threads;
+    std::vector<std::vector<size_t>> parts(threads);
+    std::vector<std::thread> workers;
+    for (size_t t = 1; t < threads; ++t) {
+        size_t from = std::min(n, t * chunk);
+        size_t to = std::min(n, from + chunk);
+        workers.emplace_back([&parts, data, from, to, base, t] {
+            ScanNewlines(data + from, to - from, base + from, parts[t]);
+        });
+    }
+    ScanNewlines(data, std::min(n, chunk), base, parts[0]);
+    size_t total = out.size();
+    for (size_t t = 0; t < threads; ++t) {
+        if (t != 0) {
+            workers[t - 1].join();
+        }
+        total += parts[t].size();
+    }
+    out.reserve(total);
+    for (size_t t = 0; t < threads; ++t) {
+        out.insert(out.end(), parts[t].begin(), parts[t].end());
+    }
+}
@@ -0,0 +1,17 @@
+#ifndef TEXT_EDITOR_LINE_SCAN_H
+#define TEXT_EDITOR_LINE_SCAN_H
+
+#include <cstddef>
+#include <vector>
+
+// Appends base + i for every data[i] == '\n', in order. Uses AVX2 or SSE2
+// when available and plain bytes otherwise.
+void ScanNewlines(const char* data, size_t n, size_t base, std::vector<size_t>& out);
+
+// Same result, but inputs of at least kParallelScan bytes are cut into
+// chunks scanned on separate threads and merged in order.
+void ScanNewlinesParallel(const char* data, size_t n, size_t base, std::vector<size_t>& out);
+
+const size_t kParallelScan = 16 << 20;
+
+#endif  // TEXT_EDITOR_LINE_SCAN_H
@@ -0,0 +1,51 @@
+#include "mapped_file.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MappedFile::MappedFile(int fd, const char* data, size_t size) : fd_(fd), data_(data), size_(size) {
+}
+
+std::unique_ptr<MappedFile> MappedFile::Open(const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return nullptr;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return nullptr;
+    }
+    size_t size = st.st_size;
+    const char* data = nullptr;
+    if (size != 0) {
+        void* map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            close(fd);
+            return nullptr;
+        }
+        data = static_cast<const char*>(map);
+    }
+    return std::unique_ptr<MappedFile>(new MappedFile(fd, data, size));
+}
+
+MappedFile::~MappedFile() {
+    if (data_) {
+        munmap(const_cast<char*>(data_), size_);
+    }
+    close(fd_);
+}
+
+int MappedFile::Fd() const {
+    return fd_;
+}
+
+const char* MappedFile::Data() const {
+    return data_;
+}
+
+size_t MappedFile::Size() const {
+    return size_;
+}
@@ -0,0 +1,27 @@
+#ifndef TEXT_EDITOR_MAPPED_FILE_H
+#define TEXT_EDITOR_MAPPED_FILE_H
+
+#include <cstddef>
+#include <memory>
+
+// Read-only private mapping of a whole file. The descriptor stays open for
+// the lifetime of the mapping so the file can be copied from later.
+class MappedFile {
+    int fd_;
+    const char* data_;
+    size_t size_;
+
+    MappedFile(int, const char*, size_t);
+
+public:
+    static std::unique_ptr<MappedFile> Open(const char* path);
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile();
+
+    int Fd() const;
+    const char* Data() const;
+    size_t Size() const;
+};
+
+#endif  // TEXT_EDITOR_MAPPED_FILE_H
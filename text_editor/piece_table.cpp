@@ -0,0 +1,978 @@
+#include "piece_table.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <sys/sendfile.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "line_scan.h"
+#include "search.h"
+
+// Scans the original for line feeds from `from`, continuing past `limit`
+// to the next line boundary. Returns that boundary, or `size` at the end.
+static size_t ScanLines(const char* data, size_t from, size_t limit, size_t size, std::vector<size_t>& lf) {
+    size_t count = lf.size();
+    ScanNewlinesParallel(data + from, limit - from, from, lf);
+    if (limit == size) {
+        return size;
+    }
+    if (lf.size() == count) {
+        const char* nl = static_cast<const char*>(memchr(data + limit, '\n', size - limit));
+        if (!nl) {
+            return size;
+        }
+        lf.push_back(nl - data);
+    }
+    return lf.back() + 1;
+}
+
+// Indexes the mapped original ahead of the editor on a worker thread and
+// publishes finished batches of line feeds for Absorb to pick up. It scans
+// kParallelScan bytes at a time, so that ScanNewlinesParallel splits the
+// work across threads, and publishes each scan in slices of about
+// kIndexChunk bytes.
+struct PieceTable::Loader {
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable published;
+    std::vector<size_t> lf;
+    std::atomic<size_t> scanned;
+    std::atomic<bool> stop;
+
+    Loader(const char* data, size_t from, size_t size) : scanned(from), stop(false) {
+        thread = std::thread([this, data, from, size] {
+            size_t pos = from;
+            std::vector<size_t> batch;
+            while (pos < size && !stop) {
+                batch.clear();
+                size_t end = ScanLines(data, pos, std::min(size, pos + kParallelScan), size, batch);
+                std::vector<size_t>::iterator first = batch.begin();
+                while (pos < end) {
+                    std::vector<size_t>::iterator last = std::lower_bound(first, batch.end(), pos + kIndexChunk);
+                    size_t next = last == batch.end() ? end : *last++ + 1;
+                    std::lock_guard<std::mutex> lock(mutex);
+                    lf.insert(lf.end(), first, last);
+                    scanned = next;
+                    published.notify_all();
+                    first = last;
+                    pos = next;
+                }
+            }
+        });
+    }
+
+    ~Loader() {
+        stop = true;
+        thread.join();
+    }
+};
+
+// What snapshots keep alive: the buffers, the mapped original and every
+// node, allocated kNodeBlock at a time.
+struct PieceTable::Store {
+    Segmented<std::unique_ptr<Buffer>> buffers;
+    std::unique_ptr<MappedFile> mapped;
+    std::vector<std::unique_ptr<Node[]>> nodes;
+    size_t used;
+
+    Store(std::string original, std::unique_ptr<MappedFile> file) : mapped(std::move(file)), used(kNodeBlock) {
+        std::unique_ptr<Buffer> buffer(new Buffer);
+        buffer->text = std::move(original);
+        buffer->data = mapped ? mapped->Data() : buffer->text.data();
+        buffers.PushBack(std::move(buffer));
+    }
+};
+
+// The version a snapshot was taken at. Snapshots hold it, and the last one
+// to let go of it raises released with a release store. The table reads
+// the flag with acquire before it reuses the nodes the version could
+// reach, so every read of them through the snapshots comes first.
+struct PieceTable::Pin {
+    size_t version;
+    std::shared_ptr<Store> store;
+    std::shared_ptr<std::atomic<bool>> released;
+
+    ~Pin() {
+        released->store(true, std::memory_order_release);
+    }
+};
+
+// The line feeds of a snapshot's unindexed tail, as offsets into the
+// original.
+struct PieceTable::Tail {
+    std::once_flag scanned;
+    std::vector<size_t> lf;
+};
+
+namespace {
+
+// First index in [lo, hi) whose line feed is at or after pos.
+size_t LowerBound(const Segmented<size_t>& lf, size_t lo, size_t hi, size_t pos) {
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (lf[mid] < pos) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+}  // namespace
+
+const size_t PieceTable::kAddChunk;
+const size_t PieceTable::kIndexChunk;
+const size_t PieceTable::kAllLines;
+const size_t PieceTable::kNodeBlock;
+
+PieceTable::PieceTable()
+    : store_(new Store(std::string(), nullptr)), original_size_(0), indexed_(0), root_(nullptr), free_(nullptr),
+      seed_(2463534242u), allocations_(0), version_(0), shared_(0) {
+}
+
+PieceTable::PieceTable(std::string original)
+    : store_(new Store(std::move(original), nullptr)), original_size_(store_->buffers[0]->text.size()),
+      indexed_(original_size_), root_(nullptr), free_(nullptr), seed_(2463534242u), allocations_(0), version_(0),
+      shared_(0) {
+    IndexLf(*store_->buffers[0], Data(0), 0, original_size_);
+    if (original_size_ != 0) {
+        Piece piece = {0, 0, original_size_, store_->buffers[0]->lf.Size(), 0};
+        root_ = NewNode(piece);
+    }
+}
+
+// The final line break of a file terminates its last line rather than
+// starting an empty one, so it is left out of the text.
+PieceTable::PieceTable(std::unique_ptr<MappedFile> original)
+    : store_(new Store(std::string(), std::move(original))), original_size_(store_->mapped->Size()), indexed_(0),
+      root_(nullptr), free_(nullptr), seed_(2463534242u), allocations_(0), version_(0), shared_(0) {
+    if (original_size_ != 0 && Data(0)[original_size_ - 1] == '\n') {
+        --original_size_;
+        if (original_size_ != 0 && Data(0)[original_size_ - 1] == '\r') {
+            --original_size_;
+        }
+    }
+}
+
+PieceTable::PieceTable(PieceTable&& other)
+    : store_(new Store(std::string(), nullptr)), original_size_(0), indexed_(0), root_(nullptr), free_(nullptr),
+      seed_(2463534242u), allocations_(0), version_(0), shared_(0) {
+    *this = std::move(other);
+}
+
+PieceTable& PieceTable::operator=(PieceTable&& other) {
+    std::swap(store_, other.store_);
+    std::swap(original_size_, other.original_size_);
+    std::swap(indexed_, other.indexed_);
+    std::swap(root_, other.root_);
+    std::swap(free_, other.free_);
+    std::swap(seed_, other.seed_);
+    std::swap(allocations_, other.allocations_);
+    std::swap(version_, other.version_);
+    std::swap(shared_, other.shared_);
+    std::swap(pins_, other.pins_);
+    std::swap(retired_, other.retired_);
+    std::swap(loader_, other.loader_);
+    return *this;
+}
+
+// Nodes go with the store, once no snapshot holds it either.
+PieceTable::~PieceTable() {
+    loader_.reset();
+}
+
+PieceTable::Snapshot PieceTable::View() const {
+    return Snapshot(nullptr, nullptr, store_.get(), root_, indexed_, original_size_);
+}
+
+const char* PieceTable::Data(size_t buffer) const {
+    return store_->buffers[buffer]->data;
+}
+
+void PieceTable::IndexLf(Buffer& buffer, const char* data, size_t from, size_t to) {
+    size_t segments = buffer.lf.Segments();
+    scratch_.clear();
+    ScanNewlinesParallel(data + from, to - from, from, scratch_);
+    buffer.lf.Append(scratch_.begin(), scratch_.end());
+    allocations_ += buffer.lf.Segments() - segments;
+}
+
+// Add buffers reserve their capacity up front and never outgrow it, so the
+// bytes a snapshot reads stay where they are.
+Piece PieceTable::Append(const char* s, size_t n) {
+    Segmented<std::unique_ptr<Buffer>>& buffers = store_->buffers;
+    Buffer* buffer = buffers.Size() == 1 ? nullptr : buffers[buffers.Size() - 1].get();
+    if (!buffer || buffer->text.capacity() - buffer->text.size() < n) {
+        std::unique_ptr<Buffer> fresh(new Buffer);
+        fresh->text.reserve(std::max(n, kAddChunk));
+        fresh->data = fresh->text.data();
+        buffer = fresh.get();
+        buffers.PushBack(std::move(fresh));
+        ++allocations_;
+    }
+    size_t start = buffer->text.size();
+    size_t lf = buffer->lf.Size();
+    buffer->text.append(s, n);
+    IndexLf(*buffer, buffer->data, start, buffer->text.size());
+    Piece piece = {buffers.Size() - 1, start, n, buffer->lf.Size() - lf, lf};
+    return piece;
+}
+
+PieceTable::Node* PieceTable::Allocate() {
+    Node* node = free_;
+    if (node) {
+        free_ = node->right;
+        return node;
+    }
+    Store& store = *store_;
+    if (store.used == kNodeBlock) {
+        store.nodes.push_back(std::unique_ptr<Node[]>(new Node[kNodeBlock]));
+        store.used = 0;
+        ++allocations_;
+    }
+    return &store.nodes.back()[store.used++];
+}
+
+PieceTable::Node* PieceTable::NewNode(const Piece& piece) {
+    seed_ ^= seed_ << 13;
+    seed_ ^= seed_ >> 17;
+    seed_ ^= seed_ << 5;
+    Node* node = Allocate();
+    *node = Node{piece, piece.length, piece.lf, seed_, version_, nullptr, nullptr};
+    return node;
+}
+
+// The node itself when no live snapshot can reach it, since then it is the
+// table's alone; otherwise a copy that takes its place, while the original
+// is retired.
+PieceTable::Node* PieceTable::Own(Node* node) {
+    if (node->version >= shared_) {
+        return node;
+    }
+    Node* copy = Allocate();
+    *copy = *node;
+    copy->version = version_;
+    retired_.push_back(std::make_pair(version_, node));
+    return copy;
+}
+
+// Forgets the pins of released snapshots and reuses the retired nodes that
+// no remaining snapshot can reach: a node retired at version r is reachable
+// only from snapshots taken before r. Nodes are shared only up to the
+// newest remaining snapshot, so once all are released edits change nodes
+// in place again.
+void PieceTable::Reclaim() {
+    size_t oldest = version_;
+    size_t kept = 0;
+    shared_ = 0;
+    for (size_t i = 0; i < pins_.size(); ++i) {
+        if (!pins_[i].second->load(std::memory_order_acquire)) {
+            oldest = std::min(oldest, pins_[i].first);
+            shared_ = pins_[i].first + 1;
+            pins_[kept++] = pins_[i];
+        }
+    }
+    pins_.resize(kept);
+    while (!retired_.empty() && retired_.front().first <= oldest) {
+        Node* node = retired_.front().second;
+        node->right = free_;
+        free_ = node;
+        retired_.pop_front();
+    }
+}
+
+size_t PieceTable::Len(const Node* node) {
+    return node ? node->len : 0;
+}
+
+size_t PieceTable::Lf(const Node* node) {
+    return node ? node->lf : 0;
+}
+
+void PieceTable::Update(Node* node) {
+    node->len = Len(node->left) + node->piece.length + Len(node->right);
+    node->lf = Lf(node->left) + node->piece.lf + Lf(node->right);
+}
+
+// A node a snapshot can reach is left as it is and retired; its children
+// are shared as well.
+void PieceTable::Free(Node* node) {
+    if (node) {
+        Free(node->left);
+        Free(node->right);
+        if (node->version < shared_) {
+            retired_.push_back(std::make_pair(version_, node));
+        } else {
+            node->right = free_;
+            free_ = node;
+        }
+    }
+}
+
+// Typing usually continues right after the text inserted last, i.e. at the
+// end of a piece that also ends the newest add buffer: grow that piece in
+// place instead of splitting the tree and allocating a node. Returns the
+// new root of the subtree, or null when the piece is elsewhere.
+PieceTable::Node* PieceTable::Extend(Node* node, size_t offset, const char* s, size_t n, size_t& lf) {
+    if (!node) {
+        return nullptr;
+    }
+    size_t left = Len(node->left);
+    if (offset <= left) {
+        Node* child = Extend(node->left, offset, s, n, lf);
+        if (!child) {
+            return nullptr;
+        }
+        node = Own(node);
+        node->left = child;
+    } else if (offset < left + node->piece.length) {
+        return nullptr;
+    } else if (offset == left + node->piece.length) {
+        const Piece& piece = node->piece;
+        size_t last = store_->buffers.Size() - 1;
+        Buffer& buffer = *store_->buffers[last];
+        if (piece.buffer != last || piece.start + piece.length != buffer.text.size() ||
+            buffer.text.capacity() - buffer.text.size() < n) {
+            return nullptr;
+        }
+        size_t before = buffer.lf.Size();
+        buffer.text.append(s, n);
+        IndexLf(buffer, buffer.data, piece.start + piece.length, buffer.text.size());
+        lf = buffer.lf.Size() - before;
+        node = Own(node);
+        node->piece.length += n;
+        node->piece.lf += lf;
+    } else {
+        Node* child = Extend(node->right, offset - left - node->piece.length, s, n, lf);
+        if (!child) {
+            return nullptr;
+        }
+        node = Own(node);
+        node->right = child;
+    }
+    node->len += n;
+    node->lf += lf;
+    return node;
+}
+
+PieceTable::Node* PieceTable::Merge(Node* a, Node* b) {
+    if (!a) {
+        return b;
+    }
+    if (!b) {
+        return a;
+    }
+    if (a->prio > b->prio) {
+        a = Own(a);
+        a->right = Merge(a->right, b);
+        Update(a);
+        return a;
+    }
+    b = Own(b);
+    b->left = Merge(a, b->left);
+    Update(b);
+    return b;
+}
+
+void PieceTable::Split(Node* node, size_t offset, Node*& l, Node*& r) {
+    if (!node) {
+        l = r = nullptr;
+        return;
+    }
+    node = Own(node);
+    size_t left = Len(node->left);
+    if (offset <= left) {
+        Split(node->left, offset, l, node->left);
+        Update(node);
+        r = node;
+    } else if (offset >= left + node->piece.length) {
+        Split(node->right, offset - left - node->piece.length, node->right, r);
+        Update(node);
+        l = node;
+    } else {
+        size_t k = offset - left;
+        Piece& piece = node->piece;
+        size_t lf = View().CountLf(piece, k, piece.length);
+        Piece tail = {piece.buffer, piece.start + k, piece.length - k, lf, piece.first + piece.lf - lf};
+        piece.length = k;
+        piece.lf -= tail.lf;
+        r = Merge(NewNode(tail), node->right);
+        node->right = nullptr;
+        Update(node);
+        l = node;
+    }
+}
+
+// Appends whole lines of the unindexed original to the tree, at least
+// kIndexChunk bytes at a time, until line y is complete or the file ends.
+// Asking for every line indexes the whole rest in one parallel scan.
+// While a loader runs, whatever it has published is taken instead, waiting
+// for the next batch when the requested line is not scanned yet.
+void PieceTable::Absorb(size_t y) {
+    while (indexed_ < original_size_ && Lf(root_) <= y) {
+        size_t from = indexed_;
+        Buffer& original = *store_->buffers[0];
+        size_t lf = original.lf.Size();
+        size_t segments = original.lf.Segments();
+        size_t end;
+        if (loader_) {
+            std::unique_lock<std::mutex> lock(loader_->mutex);
+            loader_->published.wait(lock, [this, from] { return loader_->scanned != from; });
+            original.lf.Append(loader_->lf.begin(), loader_->lf.end());
+            loader_->lf.clear();
+            end = loader_->scanned;
+        } else {
+            size_t limit = y == kAllLines ? original_size_ : std::min(original_size_, from + kIndexChunk);
+            scratch_.clear();
+            end = ScanLines(Data(0), from, limit, original_size_, scratch_);
+            original.lf.Append(scratch_.begin(), scratch_.end());
+            if (scratch_.size() > kIndexChunk) {
+                std::vector<size_t>().swap(scratch_);
+            }
+        }
+        allocations_ += original.lf.Segments() - segments;
+        Piece piece = {0, from, end - from, original.lf.Size() - lf, lf};
+        root_ = Merge(root_, NewNode(piece));
+        indexed_ = end;
+    }
+}
+
+// Absorbs until the tree holds the first `end` bytes of the text.
+void PieceTable::Reach(size_t end) {
+    while (indexed_ < original_size_ && Len(root_) < end) {
+        Absorb(Lf(root_));
+    }
+}
+
+size_t PieceTable::Size() const {
+    return View().Size();
+}
+
+void PieceTable::LoadInBackground() {
+    if (store_->mapped && indexed_ < original_size_ && !loader_) {
+        loader_.reset(new Loader(Data(0), indexed_, original_size_));
+    }
+}
+
+bool PieceTable::Loading() const {
+    return loader_ && loader_->scanned != original_size_;
+}
+
+size_t PieceTable::LoadProgress() const {
+    size_t scanned = loader_ ? loader_->scanned.load() : indexed_;
+    return original_size_ == 0 ? 100 : scanned * 100 / original_size_;
+}
+
+// Whether the tree holds the first `end` bytes of the text, once whatever
+// the loader has published so far is absorbed. Never waits for the loader.
+bool PieceTable::Reached(size_t end) {
+    while (indexed_ < original_size_ && Len(root_) < end) {
+        if (loader_ && loader_->scanned == indexed_) {
+            return false;
+        }
+        Absorb(Lf(root_));
+    }
+    return true;
+}
+
+bool PieceTable::HasLine(size_t y) {
+    Absorb(y);
+    return View().HasLine(y);
+}
+
+size_t PieceTable::LineCount() {
+    Absorb(kAllLines);
+    return View().LineCount();
+}
+
+size_t PieceTable::LineStart(size_t y) {
+    Absorb(y);
+    return View().LineStart(y);
+}
+
+size_t PieceTable::LineLength(size_t y) {
+    Absorb(y);
+    return View().LineLength(y);
+}
+
+size_t PieceTable::LineBreak(size_t y) {
+    Absorb(y);
+    return View().LineBreak(y);
+}
+
+std::string PieceTable::Line(size_t y) {
+    Absorb(y);
+    return View().Line(y);
+}
+
+char PieceTable::At(size_t offset) const {
+    return View().At(offset);
+}
+
+void PieceTable::Copy(size_t pos, size_t n, std::string& out) const {
+    View().Copy(pos, n, out);
+}
+
+// The stored bytes of [pos, pos + n) in order, the unindexed rest of a
+// mapped original included. They stay valid until the next edit; take a
+// snapshot to keep them longer.
+void PieceTable::Ranges(size_t pos, size_t n, std::vector<std::pair<const char*, size_t>>& out) const {
+    View().Ranges(pos, n, out);
+}
+
+size_t PieceTable::Find(const std::string& needle, size_t from, size_t to) const {
+    return View().Find(needle, from, to);
+}
+
+// The line that holds the byte at offset.
+size_t PieceTable::LineAt(size_t offset) {
+    Reach(offset + 1);
+    return View().LineAt(offset);
+}
+
+void PieceTable::Insert(size_t offset, const char* s, size_t n) {
+    Reclaim();
+    size_t lf = 0;
+    Reach(offset);
+    if (n == 0) {
+        return;
+    }
+    if (offset != 0 && store_->buffers.Size() > 1) {
+        if (Node* root = Extend(root_, offset, s, n, lf)) {
+            root_ = root;
+            return;
+        }
+    }
+    Node* l;
+    Node* r;
+    Split(root_, offset, l, r);
+    root_ = Merge(Merge(l, NewNode(Append(s, n))), r);
+}
+
+void PieceTable::Erase(size_t offset, size_t n) {
+    Reclaim();
+    if (n == 0) {
+        return;
+    }
+    Reach(offset + n);
+    Node* l;
+    Node* m;
+    Node* r;
+    Split(root_, offset, l, m);
+    Split(m, n, m, r);
+    Free(m);
+    root_ = Merge(l, r);
+}
+
+// Pins the current version: every node in the tree now counts as shared,
+// and the nodes made from here on belong to the next version.
+PieceTable::Snapshot PieceTable::TakeSnapshot() {
+    Reclaim();
+    std::shared_ptr<std::atomic<bool>> released = std::make_shared<std::atomic<bool>>(false);
+    std::shared_ptr<const Pin> pin(new Pin{version_, store_, released});
+    pins_.push_back(std::make_pair(version_, released));
+    ++version_;
+    shared_ = version_;
+    std::shared_ptr<Tail> tail(indexed_ < original_size_ ? new Tail : nullptr);
+    return Snapshot(pin, tail, store_.get(), root_, indexed_, original_size_);
+}
+
+void PieceTable::Print(std::ostream& os) const {
+    View().Print(os);
+}
+
+void PieceTable::Pieces(const Node* node, std::vector<Piece>& out) const {
+    if (node) {
+        Pieces(node->left, out);
+        out.push_back(node->piece);
+        Pieces(node->right, out);
+    }
+}
+
+static bool WriteAll(int fd, std::vector<iovec>& iov) {
+    size_t done = 0;
+    while (done < iov.size()) {
+        ssize_t n = writev(fd, &iov[done], std::min<size_t>(iov.size() - done, IOV_MAX));
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        while (done < iov.size() && static_cast<size_t>(n) >= iov[done].iov_len) {
+            n -= iov[done++].iov_len;
+        }
+        if (n != 0) {
+            iov[done].iov_base = static_cast<char*>(iov[done].iov_base) + n;
+            iov[done].iov_len -= n;
+        }
+    }
+    iov.clear();
+    return true;
+}
+
+// Copies [offset, offset + n) of the file in the kernel, trying
+// copy_file_range first and sendfile when the filesystems disagree.
+// Returns how many bytes made it.
+static size_t CopyRange(int in, off_t offset, size_t n, int out) {
+    bool splice = true;
+    size_t done = 0;
+    while (done != n) {
+        size_t left = n - done;
+        ssize_t copied = splice ? copy_file_range(in, &offset, out, nullptr, left, 0) : sendfile(out, in, &offset, left);
+        if (copied == -1 && errno == EINTR) {
+            continue;
+        }
+        if (copied == -1 && splice && (errno == EXDEV || errno == ENOSYS || errno == EINVAL || errno == EOPNOTSUPP)) {
+            splice = false;
+            continue;
+        }
+        if (copied <= 0) {
+            break;
+        }
+        done += copied;
+    }
+    return done;
+}
+
+// Writes the text to fd. Edited pieces are gathered into writev batches;
+// runs of the mapped original are copied from its file without passing
+// through user space, falling back to writing them from the mapping.
+bool PieceTable::WriteTo(int fd) const {
+    std::vector<Piece> pieces;
+    Pieces(root_, pieces);
+    if (indexed_ < original_size_) {
+        Piece tail = {0, indexed_, original_size_ - indexed_, 0, 0};
+        pieces.push_back(tail);
+    }
+    std::vector<iovec> iov;
+    for (size_t i = 0; i < pieces.size(); ++i) {
+        const Piece& piece = pieces[i];
+        if (piece.buffer == 0 && store_->mapped) {
+            size_t length = piece.length;
+            while (i + 1 < pieces.size() && pieces[i + 1].buffer == 0 &&
+                   pieces[i + 1].start == piece.start + length) {
+                length += pieces[++i].length;
+            }
+            if (!WriteAll(fd, iov)) {
+                return false;
+            }
+            size_t copied = CopyRange(store_->mapped->Fd(), piece.start, length, fd);
+            if (copied != length) {
+                iovec run = {const_cast<char*>(Data(0)) + piece.start + copied, length - copied};
+                iov.push_back(run);
+            }
+            continue;
+        }
+        iovec run = {const_cast<char*>(Data(piece.buffer)) + piece.start, piece.length};
+        iov.push_back(run);
+    }
+    return WriteAll(fd, iov);
+}
+
+size_t PieceTable::Allocations() const {
+    return allocations_;
+}
+
+PieceTable::Snapshot::Snapshot() : store_(nullptr), root_(nullptr), indexed_(0), original_size_(0) {
+}
+
+PieceTable::Snapshot::Snapshot(std::shared_ptr<const Pin> pin, std::shared_ptr<Tail> tail, const Store* store,
+                               const Node* root, size_t indexed, size_t original_size)
+    : pin_(std::move(pin)), tail_(std::move(tail)), store_(store), root_(root), indexed_(indexed),
+      original_size_(original_size) {
+}
+
+const char* PieceTable::Snapshot::Data(size_t buffer) const {
+    return store_->buffers[buffer]->data;
+}
+
+// Only the piece's own run of line feeds is searched; the buffer may have
+// grown past it since.
+size_t PieceTable::Snapshot::CountLf(const Piece& piece, size_t from, size_t to) const {
+    const Segmented<size_t>& lf = store_->buffers[piece.buffer]->lf;
+    size_t end = piece.first + piece.lf;
+    return LowerBound(lf, piece.first, end, piece.start + to) - LowerBound(lf, piece.first, end, piece.start + from);
+}
+
+// Offset of the k-th line feed, k >= 1, or Size() when there are fewer.
+size_t PieceTable::Snapshot::NewlineOffset(size_t k) const {
+    if (k > Lf(root_)) {
+        return TailNewline(k - Lf(root_));
+    }
+    size_t offset = 0;
+    const Node* node = root_;
+    while (node) {
+        size_t left_lf = Lf(node->left);
+        if (k <= left_lf) {
+            node = node->left;
+            continue;
+        }
+        k -= left_lf;
+        offset += Len(node->left);
+        const Piece& piece = node->piece;
+        if (k <= piece.lf) {
+            return offset + store_->buffers[piece.buffer]->lf[piece.first + k - 1] - piece.start;
+        }
+        k -= piece.lf;
+        offset += piece.length;
+        node = node->right;
+    }
+    return offset;
+}
+
+// The same for the unindexed rest of a mapped original.
+size_t PieceTable::Snapshot::TailNewline(size_t k) const {
+    if (indexed_ == original_size_) {
+        return Size();
+    }
+    const std::vector<size_t>& lf = TailLf();
+    return k <= lf.size() ? Len(root_) + lf[k - 1] - indexed_ : Size();
+}
+
+// Scans the unindexed tail on the first call. Only a taken snapshot has a
+// tail to scan into: the table absorbs the lines its own queries reach
+// before it asks a view, so a view never gets here.
+const std::vector<size_t>& PieceTable::Snapshot::TailLf() const {
+    Tail& tail = *tail_;
+    std::call_once(tail.scanned, [this, &tail] {
+        ScanNewlinesParallel(Data(0) + indexed_, original_size_ - indexed_, indexed_, tail.lf);
+    });
+    return tail.lf;
+}
+
+void PieceTable::Snapshot::Collect(const Node* node, size_t pos, size_t n, std::string& out) const {
+    if (!node || n == 0) {
+        return;
+    }
+    size_t left = Len(node->left);
+    if (pos < left) {
+        size_t take = std::min(n, left - pos);
+        Collect(node->left, pos, take, out);
+        pos += take;
+        n -= take;
+    }
+    if (n == 0) {
+        return;
+    }
+    const Piece& piece = node->piece;
+    if (pos < left + piece.length) {
+        size_t from = pos - left;
+        size_t take = std::min(n, piece.length - from);
+        out.append(Data(piece.buffer) + piece.start + from, take);
+        pos += take;
+        n -= take;
+    }
+    if (n != 0) {
+        Collect(node->right, pos - left - piece.length, n, out);
+    }
+}
+
+// Like Collect, but hands out the stored bytes in place.
+void PieceTable::Snapshot::Ranges(const Node* node, size_t pos, size_t n,
+                                  std::vector<std::pair<const char*, size_t>>& out) const {
+    if (!node || n == 0) {
+        return;
+    }
+    size_t left = Len(node->left);
+    if (pos < left) {
+        size_t take = std::min(n, left - pos);
+        Ranges(node->left, pos, take, out);
+        pos += take;
+        n -= take;
+    }
+    if (n == 0) {
+        return;
+    }
+    const Piece& piece = node->piece;
+    if (pos < left + piece.length) {
+        size_t from = pos - left;
+        size_t take = std::min(n, piece.length - from);
+        out.push_back(std::make_pair(Data(piece.buffer) + piece.start + from, take));
+        pos += take;
+        n -= take;
+    }
+    if (n != 0) {
+        Ranges(node->right, pos - left - piece.length, n, out);
+    }
+}
+
+void PieceTable::Snapshot::Write(const Node* node, std::ostream& os) const {
+    if (node) {
+        Write(node->left, os);
+        os.write(Data(node->piece.buffer) + node->piece.start, node->piece.length);
+        Write(node->right, os);
+    }
+}
+
+size_t PieceTable::Snapshot::Size() const {
+    return Len(root_) + original_size_ - indexed_;
+}
+
+bool PieceTable::Snapshot::HasLine(size_t y) const {
+    return y <= Lf(root_) || TailNewline(y - Lf(root_)) != Size();
+}
+
+size_t PieceTable::Snapshot::LineCount() const {
+    return Lf(root_) + (indexed_ < original_size_ ? TailLf().size() : 0) + 1;
+}
+
+size_t PieceTable::Snapshot::LineStart(size_t y) const {
+    return y == 0 ? 0 : NewlineOffset(y) + 1;
+}
+
+size_t PieceTable::Snapshot::LineLength(size_t y) const {
+    size_t start = LineStart(y);
+    return LineEnd(start, NewlineOffset(y + 1)) - start;
+}
+
+// Bytes of the break that ends line y: 2 for CRLF, 1 for LF and 0 for the
+// last line.
+size_t PieceTable::Snapshot::LineBreak(size_t y) const {
+    size_t nl = NewlineOffset(y + 1);
+    return nl == Size() ? 0 : nl + 1 - LineEnd(LineStart(y), nl);
+}
+
+// End of the line that starts at start and whose line feed is at nl, or
+// that runs to the end of the text when nl is Size().
+size_t PieceTable::Snapshot::LineEnd(size_t start, size_t nl) const {
+    return nl != Size() && nl > start && At(nl - 1) == '\r' ? nl - 1 : nl;
+}
+
+std::string PieceTable::Snapshot::Line(size_t y) const {
+    std::string line;
+    Copy(LineStart(y), LineLength(y), line);
+    return line;
+}
+
+// The line that holds the byte at offset.
+size_t PieceTable::Snapshot::LineAt(size_t offset) const {
+    size_t len = Len(root_);
+    if (offset >= len) {
+        size_t end = indexed_ + std::min(offset, Size()) - len;
+        if (indexed_ == end) {
+            return Lf(root_);
+        }
+        const std::vector<size_t>& lf = TailLf();
+        return Lf(root_) + (std::lower_bound(lf.begin(), lf.end(), end) - lf.begin());
+    }
+    size_t y = 0;
+    const Node* node = root_;
+    while (node) {
+        size_t left = Len(node->left);
+        if (offset < left) {
+            node = node->left;
+            continue;
+        }
+        y += Lf(node->left);
+        offset -= left;
+        if (offset < node->piece.length) {
+            return y + CountLf(node->piece, 0, offset);
+        }
+        y += node->piece.lf;
+        offset -= node->piece.length;
+        node = node->right;
+    }
+    return y;
+}
+
+char PieceTable::Snapshot::At(size_t offset) const {
+    const Node* node = root_;
+    size_t pos = offset;
+    while (node) {
+        size_t left = Len(node->left);
+        if (pos < left) {
+            node = node->left;
+        } else if (pos < left + node->piece.length) {
+            return Data(node->piece.buffer)[node->piece.start + pos - left];
+        } else {
+            pos -= left + node->piece.length;
+            node = node->right;
+        }
+    }
+    return offset < Size() ? Data(0)[indexed_ + offset - Len(root_)] : '\0';
+}
+
+void PieceTable::Snapshot::Copy(size_t pos, size_t n, std::string& out) const {
+    size_t len = Len(root_);
+    size_t end = std::min(pos + n, Size());
+    if (pos < len) {
+        Collect(root_, pos, std::min(end, len) - pos, out);
+    }
+    if (end > len) {
+        size_t from = std::max(pos, len);
+        out.append(Data(0) + indexed_ + (from - len), end - from);
+    }
+}
+
+// The stored bytes of [pos, pos + n) in order, the unindexed rest of a
+// mapped original included. They stay valid as long as the snapshot.
+void PieceTable::Snapshot::Ranges(size_t pos, size_t n, std::vector<std::pair<const char*, size_t>>& out) const {
+    size_t len = Len(root_);
+    size_t end = std::min(pos + n, Size());
+    if (pos < len) {
+        Ranges(root_, pos, std::min(end, len) - pos, out);
+    }
+    if (end > len) {
+        size_t from = std::max(pos, len);
+        out.push_back(std::make_pair(Data(0) + indexed_ + (from - len), end - from));
+    }
+}
+
+// Offset of the first occurrence of needle that starts in [from, to), or
+// kNotFound. Pieces are searched where they are stored, the unindexed rest
+// of a mapped original included, so nothing is copied or indexed except
+// the few bytes around piece boundaries a match could straddle.
+size_t PieceTable::Snapshot::Find(const std::string& needle, size_t from, size_t to) const {
+    size_t m = needle.size();
+    size_t size = Size();
+    to = std::min(to, size);
+    if (m == 0 || from >= to || m > size - from) {
+        return kNotFound;
+    }
+    size_t end = std::min(size, to + m - 1);
+    std::vector<std::pair<const char*, size_t>> ranges;
+    Ranges(from, end - from, ranges);
+    std::string carry;
+    std::string joined;
+    size_t base = from;
+    for (size_t i = 0; i < ranges.size(); ++i) {
+        if (!carry.empty()) {
+            joined = carry;
+            for (size_t j = i; j < ranges.size() && joined.size() < carry.size() + m - 1; ++j) {
+                joined.append(ranges[j].first, std::min(ranges[j].second, carry.size() + m - 1 - joined.size()));
+            }
+            size_t at = FindBytes(joined.data(), joined.size(), needle.data(), m);
+            if (at < carry.size()) {
+                at += base - carry.size();
+                return at < to ? at : kNotFound;
+            }
+        }
+        size_t at = FindBytes(ranges[i].first, ranges[i].second, needle.data(), m);
+        if (at != kNotFound) {
+            return base + at < to ? base + at : kNotFound;
+        }
+        size_t keep = std::min(ranges[i].second, m - 1);
+        carry.append(ranges[i].first + ranges[i].second - keep, keep);
+        if (carry.size() > m - 1) {
+            carry.erase(0, carry.size() - (m - 1));
+        }
+        base += ranges[i].second;
+    }
+    return kNotFound;
+}
+
+void PieceTable::Snapshot::Print(std::ostream& os) const {
+    Write(root_, os);
+    if (indexed_ < original_size_) {
+        os.write(Data(0) + indexed_, original_size_ - indexed_);
+    }
+}
@@ -0,0 +1,192 @@
+#ifndef TEXT_EDITOR_PIECE_TABLE_H
+#define TEXT_EDITOR_PIECE_TABLE_H
+
+#include <atomic>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+#include "mapped_file.h"
+#include "segmented.h"
+
+struct Piece {
+    size_t buffer;
+    size_t start;
+    size_t length;
+    size_t lf;
+    size_t first;
+};
+
+// Text storage: the original buffer is never modified, inserted text goes
+// to append-only add buffers, and the document is the in-order sequence of
+// pieces kept in a treap augmented with subtree byte and line-feed counts.
+// Every buffer keeps the offsets of its line feeds, and a piece knows where
+// its own run of them starts, so counting or finding line feeds inside a
+// piece is a binary search rather than a scan.
+//
+// Line breaks are kept as stored, LF or CRLF, line by line. A carriage
+// return before a line feed belongs to the break rather than to the line:
+// LineLength leaves it out and LineBreak counts it.
+//
+// A mapped original is indexed lazily: only its prefix [0, indexed_) is in
+// the tree, and whole lines are pulled in as queries reach past it. A
+// background loader can scan the rest ahead of those queries.
+//
+// TakeSnapshot returns the current version in O(1). Buffers and line-feed
+// indexes never move what they store, and a node that a live snapshot can
+// reach is never changed: an edit copies the nodes on its path instead and
+// retires the originals, stamped with the current version. A retired node
+// is reused only once every snapshot older than its stamp is gone, so
+// snapshots are read on other threads without locks, and nothing the
+// editing thread does waits for them.
+class PieceTable {
+    struct Loader;
+    struct Store;
+    struct Pin;
+    struct Tail;
+
+    struct Buffer {
+        std::string text;
+        const char* data;
+        Segmented<size_t> lf;
+    };
+
+    struct Node {
+        Piece piece;
+        size_t len;
+        size_t lf;
+        unsigned prio;
+        size_t version;
+        Node* left;
+        Node* right;
+    };
+
+    static const size_t kNodeBlock = 256;
+
+public:
+    class Snapshot;
+
+private:
+    std::shared_ptr<Store> store_;
+    size_t original_size_;
+    size_t indexed_;
+    Node* root_;
+    Node* free_;
+    unsigned seed_;
+    size_t allocations_;
+    size_t version_;
+    size_t shared_;
+    std::vector<std::pair<size_t, std::shared_ptr<std::atomic<bool>>>> pins_;
+    std::deque<std::pair<size_t, Node*>> retired_;
+    std::vector<size_t> scratch_;
+    std::unique_ptr<Loader> loader_;
+
+    Snapshot View() const;
+    const char* Data(size_t buffer) const;
+    void IndexLf(Buffer&, const char*, size_t from, size_t to);
+    void Absorb(size_t);
+    void Reach(size_t);
+    Piece Append(const char*, size_t);
+    Node* Allocate();
+    Node* NewNode(const Piece&);
+    Node* Own(Node*);
+    void Reclaim();
+    static size_t Len(const Node*);
+    static size_t Lf(const Node*);
+    static void Update(Node*);
+    void Free(Node*);
+    Node* Extend(Node*, size_t, const char*, size_t, size_t&);
+    Node* Merge(Node*, Node*);
+    void Split(Node*, size_t, Node*&, Node*&);
+    void Pieces(const Node*, std::vector<Piece>&) const;
+
+public:
+    static const size_t kAddChunk = 1 << 16;
+    static const size_t kIndexChunk = 1 << 20;
+    static const size_t kAllLines = static_cast<size_t>(-1);
+
+    PieceTable();
+    explicit PieceTable(std::string original);
+    explicit PieceTable(std::unique_ptr<MappedFile> original);
+    PieceTable(PieceTable&&);
+    PieceTable& operator=(PieceTable&&);
+    PieceTable(const PieceTable&) = delete;
+    PieceTable& operator=(const PieceTable&) = delete;
+    ~PieceTable();
+
+    void LoadInBackground();
+    bool Loading() const;
+    size_t LoadProgress() const;
+    bool Reached(size_t);
+    size_t Size() const;
+    bool HasLine(size_t);
+    size_t LineCount();
+    size_t LineStart(size_t);
+    size_t LineLength(size_t);
+    size_t LineBreak(size_t);
+    std::string Line(size_t);
+    char At(size_t) const;
+    void Copy(size_t, size_t, std::string&) const;
+    void Ranges(size_t, size_t, std::vector<std::pair<const char*, size_t>>&) const;
+    size_t Find(const std::string&, size_t from, size_t to) const;
+    size_t LineAt(size_t);
+    void Insert(size_t, const char*, size_t);
+    void Erase(size_t, size_t);
+    void Print(std::ostream&) const;
+    bool WriteTo(int fd) const;
+    size_t Allocations() const;
+    Snapshot TakeSnapshot();
+};
+
+// One version of the text, read with the same queries as the table. It
+// keeps its nodes and buffers alive, the table included, and may be copied
+// and handed to other threads; anything that synchronizes the handover (a
+// mutex, starting the thread) makes the version visible there. Lines past
+// the indexed prefix of a mapped original are found by scanning it once,
+// on the first query that needs them; the copies of a snapshot share that
+// scan.
+class PieceTable::Snapshot {
+public:
+    Snapshot();
+
+    size_t Size() const;
+    bool HasLine(size_t) const;
+    size_t LineCount() const;
+    size_t LineStart(size_t) const;
+    size_t LineLength(size_t) const;
+    size_t LineBreak(size_t) const;
+    std::string Line(size_t) const;
+    size_t LineAt(size_t) const;
+    char At(size_t) const;
+    void Copy(size_t, size_t, std::string&) const;
+    void Ranges(size_t, size_t, std::vector<std::pair<const char*, size_t>>&) const;
+    size_t Find(const std::string&, size_t from, size_t to) const;
+    void Print(std::ostream&) const;
+
+private:
+    friend class PieceTable;
+
+    std::shared_ptr<const Pin> pin_;
+    std::shared_ptr<Tail> tail_;
+    const Store* store_;
+    const Node* root_;
+    size_t indexed_;
+    size_t original_size_;
+
+    Snapshot(std::shared_ptr<const Pin>, std::shared_ptr<Tail>, const Store*, const Node*, size_t indexed,
+             size_t original_size);
+    const char* Data(size_t buffer) const;
+    const std::vector<size_t>& TailLf() const;
+    size_t CountLf(const Piece&, size_t from, size_t to) const;
+    size_t NewlineOffset(size_t) const;
+    size_t LineEnd(size_t start, size_t nl) const;
+    size_t TailNewline(size_t) const;
+    void Collect(const Node*, size_t, size_t, std::string&) const;
+    void Ranges(const Node*, size_t, size_t, std::vector<std::pair<const char*, size_t>>&) const;
+    void Write(const Node*, std::ostream&) const;
+};
+
+#endif  // TEXT_EDITOR_PIECE_TABLE_H
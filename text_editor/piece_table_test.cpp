@@ -0,0 +1,142 @@
+// Stress test for snapshots read on another thread: the main thread edits
+// the table, takes snapshots and lets go of them, while a reader walks the
+// newest one it was handed and checks it against the text it was taken at.
+// Retired nodes are reused as soon as the reader is done with a version, so
+// reusing one too early shows up as a mismatch here, or as a race under
+// -fsanitize=thread. Typing at one spot is checked as well: it extends the
+// piece before the cursor in place, so allocations grow only with the add
+// buffers it fills, not with the keystrokes.
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include "piece_table.h"
+
+namespace {
+
+const int kEdits = 200000;
+const int kSnapshotEvery = 16;
+const size_t kMaxSize = 4096;
+const size_t kWarmUp = 1024;
+const size_t kTyped = 1 << 20;
+
+// The newest snapshot and its text. The reader polls the flags relaxed and
+// locks only to take a snapshot, never after letting go of one, so that
+// nothing but the table's own pins orders its reads before the table
+// reuses what they reached.
+struct Handoff {
+    std::mutex mutex;
+    PieceTable::Snapshot snapshot;
+    std::string expected;
+    std::atomic<bool> fresh;
+    std::atomic<bool> done;
+};
+
+// Every line and the whole text of the snapshot, as the reader sees them.
+bool Matches(const PieceTable::Snapshot& snapshot, const std::string& expected) {
+    std::string whole;
+    snapshot.Copy(0, snapshot.Size(), whole);
+    if (whole != expected) {
+        return false;
+    }
+    std::string lines;
+    for (size_t y = 0; y < snapshot.LineCount(); ++y) {
+        if (y != 0) {
+            lines += '\n';
+        }
+        lines += snapshot.Line(y);
+    }
+    return lines == expected;
+}
+
+// Types kTyped characters one at a time in the middle of a line, after
+// kWarmUp of them; returns the allocations the typed ones made.
+size_t TypingAllocations() {
+    PieceTable table(std::string("first line\nsecond line\n"));
+    size_t at = 5;
+    for (size_t i = 0; i < kWarmUp; ++i) {
+        table.Insert(at++, "x", 1);
+    }
+    size_t warm = table.Allocations();
+    for (size_t i = 0; i < kTyped; ++i) {
+        table.Insert(at++, "x", 1);
+    }
+    return table.Allocations() - warm;
+}
+
+}  // namespace
+
+int main() {
+    PieceTable table(std::string("first line\nsecond line\nthird line\n"));
+    std::string text = "first line\nsecond line\nthird line\n";
+    Handoff handoff;
+    handoff.fresh = false;
+    handoff.done = false;
+    std::atomic<int> checked(0);
+    std::atomic<int> failed(0);
+
+    std::thread reader([&] {
+        while (!handoff.done.load(std::memory_order_relaxed)) {
+            if (!handoff.fresh.load(std::memory_order_relaxed)) {
+                std::this_thread::yield();
+                continue;
+            }
+            PieceTable::Snapshot snapshot;
+            std::string expected;
+            {
+                std::lock_guard<std::mutex> lock(handoff.mutex);
+                snapshot = std::move(handoff.snapshot);
+                handoff.snapshot = PieceTable::Snapshot();
+                expected.swap(handoff.expected);
+                handoff.fresh.store(false, std::memory_order_relaxed);
+            }
+            if (!Matches(snapshot, expected)) {
+                ++failed;
+            }
+            ++checked;
+        }
+    });
+
+    unsigned seed = 12345;
+    for (int i = 0; i < kEdits; ++i) {
+        seed = seed * 1103515245 + 12345;
+        size_t at = text.empty() ? 0 : (seed >> 8) % (text.size() + 1);
+        if (text.size() < 64 || (text.size() < kMaxSize && (seed >> 4) % 3 != 0)) {
+            const char* s = (seed >> 6) % 5 == 0 ? "\n" : "ab";
+            table.Insert(at, s, strlen(s));
+            text.insert(at, s);
+        } else {
+            size_t n = std::min<size_t>(1 + (seed >> 12) % 8, text.size() - std::min(at, text.size()));
+            at = std::min(at, text.size() - n);
+            table.Erase(at, n);
+            text.erase(at, n);
+        }
+        if (i % kSnapshotEvery == 0) {
+            PieceTable::Snapshot snapshot = table.TakeSnapshot();
+            std::lock_guard<std::mutex> lock(handoff.mutex);
+            handoff.snapshot = std::move(snapshot);
+            handoff.expected = text;
+            handoff.fresh.store(true, std::memory_order_relaxed);
+        }
+    }
+    handoff.done.store(true, std::memory_order_relaxed);
+    reader.join();
+
+    std::string whole;
+    table.Copy(0, table.Size(), whole);
+    if (whole != text) {
+        ++failed;
+    }
+    printf("%d snapshots checked, %d mismatches\n", checked.load(), failed.load());
+
+    size_t typing = TypingAllocations();
+    size_t buffers = kTyped / PieceTable::kAddChunk + 1;
+    printf("%zu characters typed, %zu allocations, at most %zu expected\n", kTyped, typing, buffers);
+    return failed == 0 && checked != 0 && typing <= buffers ? EXIT_SUCCESS : EXIT_FAILURE;
+}
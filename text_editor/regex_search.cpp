@@ -0,0 +1,219 @@
+#include "regex_search.h"
+
+#include <algorithm>
+#include <cstring>
+
+const size_t RegexSearch::kChunk;
+const size_t RegexSearch::kWindow;
+const size_t RegexSearch::kOverlap;
+
+RegexSearch::RegexSearch()
+    : size_(0), chunks_(0), polled_(0), next_(0), exited_(0), stop_(false), windowed_(false) {
+}
+
+RegexSearch::~RegexSearch() {
+    Stop();
+    Join();
+}
+
+// Returns false, leaving nothing running, when the pattern does not compile.
+bool RegexSearch::Start(const std::string& pattern, PieceTable::Snapshot text) {
+    Stop();
+    Join();
+    try {
+        regex_.assign(pattern, std::regex::ECMAScript | std::regex::optimize);
+    } catch (const std::regex_error&) {
+        chunks_ = 0;
+        polled_ = 0;
+        return false;
+    }
+    text_ = std::move(text);
+    ranges_.clear();
+    text_.Ranges(0, text_.Size(), ranges_);
+    starts_.clear();
+    size_ = 0;
+    for (size_t i = 0; i < ranges_.size(); ++i) {
+        starts_.push_back(size_);
+        size_ += ranges_[i].second;
+    }
+    chunks_ = (size_ + kChunk - 1) / kChunk;
+    polled_ = 0;
+    results_.assign(chunks_, std::vector<Match>());
+    done_.assign(chunks_, false);
+    next_ = 0;
+    exited_ = 0;
+    stop_ = false;
+    windowed_ = false;
+    size_t threads = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), chunks_);
+    for (size_t t = 0; t < threads; ++t) {
+        workers_.push_back(std::thread(&RegexSearch::Work, this));
+    }
+    return true;
+}
+
+// Tells the workers to stop and returns at once; Reap, Wait or the next
+// Start joins them. Matches of the chunks finished so far can still be
+// polled.
+void RegexSearch::Stop() {
+    stop_ = true;
+}
+
+// Waits for the workers to scan the remaining chunks, or to stop.
+void RegexSearch::Wait() {
+    Join();
+}
+
+// Joins the workers and lets go of the snapshot once every worker has
+// exited, without waiting for any. Returns whether some are still running.
+bool RegexSearch::Reap() {
+    if (workers_.empty()) {
+        return false;
+    }
+    if (exited_ != workers_.size()) {
+        return true;
+    }
+    Join();
+    return false;
+}
+
+void RegexSearch::Join() {
+    for (std::thread& worker : workers_) {
+        worker.join();
+    }
+    workers_.clear();
+    ranges_.clear();
+    text_ = PieceTable::Snapshot();
+}
+
+bool RegexSearch::Finished() const {
+    return polled_ == chunks_;
+}
+
+// Whether a match turned up in a line longer than kWindow. Such a match
+// may be cut short, or be one the whole line would not have given.
+bool RegexSearch::Windowed() const {
+    return windowed_;
+}
+
+size_t RegexSearch::Progress() const {
+    return chunks_ == 0 ? 100 : polled_ * 100 / chunks_;
+}
+
+size_t RegexSearch::Poll(std::vector<Match>& out) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t count = out.size();
+    while (polled_ < chunks_ && done_[polled_]) {
+        out.insert(out.end(), results_[polled_].begin(), results_[polled_].end());
+        std::vector<Match>().swap(results_[polled_]);
+        ++polled_;
+    }
+    return out.size() - count;
+}
+
+void RegexSearch::Work() {
+    std::string text;
+    std::vector<Match> found;
+    size_t chunk;
+    while (!stop_ && (chunk = next_++) < chunks_) {
+        found.clear();
+        if (Scan(chunk * kChunk, std::min(size_, (chunk + 1) * kChunk), text, found)) {
+            windowed_ = true;
+        }
+        if (stop_) {
+            break;
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        results_[chunk].swap(found);
+        done_[chunk] = true;
+    }
+    ++exited_;
+}
+
+// Matches in the lines that start in [begin, end). The byte before begin
+// tells whether a line starts at begin, and the last line is read on past
+// end to its line feed. A carriage return before the line feed is not part
+// of the line. Returns whether a line searched in windows had a match.
+bool RegexSearch::Scan(size_t begin, size_t end, std::string& text, std::vector<Match>& found) const {
+    size_t from = begin == 0 ? 0 : begin - 1;
+    text.clear();
+    Gather(from, end - from, text);
+    size_t to = end;
+    size_t searched = text.size() - 1;
+    while (to < size_ && !stop_ && !memchr(text.data() + searched, '\n', text.size() - searched)) {
+        searched = text.size();
+        size_t n = std::min(kChunk / 16, size_ - to);
+        Gather(to, n, text);
+        to += n;
+    }
+    const char* data = text.data();
+    const char* stop = data + text.size();
+    const char* line = data;
+    if (begin != 0) {
+        line = static_cast<const char*>(memchr(data, '\n', stop - data));
+        line = line ? line + 1 : stop;
+    }
+    bool windowed = false;
+    while (line < stop && static_cast<size_t>(line - data) + from < end && !stop_) {
+        const char* nl = static_cast<const char*>(memchr(line, '\n', stop - line));
+        const char* eol = nl && nl != line && nl[-1] == '\r' ? nl - 1 : nl ? nl : stop;
+        size_t count = found.size();
+        Line(line, eol, from + (line - data), found);
+        windowed = windowed || (static_cast<size_t>(eol - line) > kWindow && found.size() != count);
+        line = nl ? nl + 1 : stop;
+    }
+    return windowed;
+}
+
+// std::regex recurses about as deep as the text it consumes, which runs out
+// of stack on a line of a few ten thousand bytes, so a longer line is
+// searched in windows of kWindow bytes. A match counts only if it ends at
+// least kOverlap bytes before the end of its window, and the next window
+// starts at the first match that does not; only a match longer than that
+// can be cut short.
+void RegexSearch::Line(const char* line, const char* eol, size_t offset, std::vector<Match>& found) const {
+    const char* pos = line;
+    while (true) {
+        bool last = static_cast<size_t>(eol - pos) <= kWindow;
+        const char* end = last ? eol : pos + kWindow;
+        const char* limit = last ? eol : end - kOverlap;
+        std::regex_constants::match_flag_type flags =
+            pos == line ? std::regex_constants::match_default : std::regex_constants::match_prev_avail;
+        if (!last) {
+            flags |= std::regex_constants::match_not_eol;
+        }
+        const char* next = limit;
+        for (std::cregex_iterator it(pos, end, regex_, flags), stop; it != stop; ++it) {
+            const char* first = (*it)[0].first;
+            const char* second = (*it)[0].second;
+            if (second > limit && first != pos) {
+                next = first;
+                break;
+            }
+            if (second != first) {
+                Match match = {offset + (first - line), static_cast<size_t>(second - first)};
+                found.push_back(match);
+            }
+            if (second > limit) {
+                next = second;
+                break;
+            }
+        }
+        if (last || stop_) {
+            break;
+        }
+        pos = next;
+    }
+}
+
+// Appends bytes [pos, pos + n) of the text.
+void RegexSearch::Gather(size_t pos, size_t n, std::string& out) const {
+    size_t i = std::upper_bound(starts_.begin(), starts_.end(), pos) - starts_.begin() - 1;
+    while (n != 0) {
+        size_t skip = pos - starts_[i];
+        size_t take = std::min(n, ranges_[i].second - skip);
+        out.append(ranges_[i].first + skip, take);
+        pos += take;
+        n -= take;
+        ++i;
+    }
+}
@@ -0,0 +1,76 @@
+#ifndef TEXT_EDITOR_REGEX_SEARCH_H
+#define TEXT_EDITOR_REGEX_SEARCH_H
+
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <regex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "piece_table.h"
+
+// Regex search over the bytes of a text, one line at a time. The text is
+// cut into chunks of kChunk bytes, and a chunk owns the lines that start
+// in it. A pool of worker threads takes chunks in order and scans them in
+// parallel; Poll hands out the matches of every finished chunk that no
+// unfinished chunk precedes, so matches arrive in text order while later
+// chunks are still being scanned.
+//
+// The search reads a snapshot of the text, so the text may change while it
+// runs; offsets of matches are in the version it started on. Stop does not
+// wait for the workers; Reap, called every frame, joins them once they have
+// all exited and lets go of the snapshot.
+class RegexSearch {
+public:
+    struct Match {
+        size_t offset;
+        size_t length;
+    };
+
+    typedef std::vector<std::pair<const char*, size_t>> Ranges;
+
+    static const size_t kChunk = 1 << 20;
+    static const size_t kWindow = 1 << 12;
+    static const size_t kOverlap = 1 << 10;
+
+    RegexSearch();
+    RegexSearch(const RegexSearch&) = delete;
+    RegexSearch& operator=(const RegexSearch&) = delete;
+    ~RegexSearch();
+
+    bool Start(const std::string& pattern, PieceTable::Snapshot text);
+    void Stop();
+    void Wait();
+    bool Reap();
+    bool Finished() const;
+    bool Windowed() const;
+    size_t Progress() const;
+    size_t Poll(std::vector<Match>& out);
+
+private:
+    std::regex regex_;
+    PieceTable::Snapshot text_;
+    Ranges ranges_;
+    std::vector<size_t> starts_;
+    size_t size_;
+    size_t chunks_;
+    size_t polled_;
+    std::atomic<size_t> next_;
+    std::atomic<size_t> exited_;
+    std::atomic<bool> stop_;
+    std::atomic<bool> windowed_;
+    std::mutex mutex_;
+    std::vector<std::vector<Match>> results_;
+    std::vector<bool> done_;
+    std::vector<std::thread> workers_;
+
+    void Join();
+    void Work();
+    bool Scan(size_t begin, size_t end, std::string& text, std::vector<Match>& found) const;
+    void Line(const char* line, const char* eol, size_t offset, std::vector<Match>& found) const;
+    void Gather(size_t pos, size_t n, std::string& out) const;
+};
+
+#endif  // TEXT_EDITOR_REGEX_SEARCH_H
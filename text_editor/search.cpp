@@ -0,0 +1,85 @@
+#include "search.h"
+
+#include <cstring>
+
+#if defined(__GNUC__) && defined(__SSE2__)
+#include <immintrin.h>
+#define SEARCH_X86
+#endif
+
+namespace {
+
+// Both return how far they got: no candidate before that offset matched.
+#ifdef SEARCH_X86
+size_t FindSse2(const char* data, size_t n, const char* needle, size_t m, size_t& found) {
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[m - 1]);
+    size_t i = 0;
+    for (; i + m - 1 + 16 <= n; i += 16) {
+        __m128i head = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        __m128i tail = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + m - 1));
+        unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(head, first), _mm_cmpeq_epi8(tail, last)));
+        while (mask) {
+            size_t at = i + __builtin_ctz(mask);
+            if (memcmp(data + at + 1, needle + 1, m - 2) == 0) {
+                found = at;
+                return i;
+            }
+            mask &= mask - 1;
+        }
+    }
+    return i;
+}
+
+__attribute__((target("avx2"))) size_t FindAvx2(const char* data, size_t n, const char* needle, size_t m,
+                                                size_t& found) {
+    const __m256i first = _mm256_set1_epi8(needle[0]);
+    const __m256i last = _mm256_set1_epi8(needle[m - 1]);
+    size_t i = 0;
+    for (; i + m - 1 + 32 <= n; i += 32) {
+        __m256i head = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        __m256i tail = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + m - 1));
+        unsigned mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(head, first),
+                                                              _mm256_cmpeq_epi8(tail, last)));
+        while (mask) {
+            size_t at = i + __builtin_ctz(mask);
+            if (memcmp(data + at + 1, needle + 1, m - 2) == 0) {
+                found = at;
+                return i;
+            }
+            mask &= mask - 1;
+        }
+    }
+    return i;
+}
+#endif
+
+}  // namespace
+
+size_t FindBytes(const char* data, size_t n, const char* needle, size_t m) {
+    if (m == 0) {
+        return 0;
+    }
+    if (m > n) {
+        return kNotFound;
+    }
+    if (m == 1) {
+        const char* at = static_cast<const char*>(memchr(data, needle[0], n));
+        return at ? at - data : kNotFound;
+    }
+    size_t i = 0;
+#ifdef SEARCH_X86
+    static const bool avx2 = (__builtin_cpu_init(), __builtin_cpu_supports("avx2"));
+    size_t found = kNotFound;
+    i = avx2 ? FindAvx2(data, n, needle, m, found) : FindSse2(data, n, needle, m, found);
+    if (found != kNotFound) {
+        return found;
+    }
+#endif
+    for (; i + m <= n; ++i) {
+        if (data[i] == needle[0] && data[i + m - 1] == needle[m - 1] && memcmp(data + i, needle, m) == 0) {
+            return i;
+        }
+    }
+    return kNotFound;
+}
@@ -0,0 +1,14 @@
+#ifndef TEXT_EDITOR_SEARCH_H
+#define TEXT_EDITOR_SEARCH_H
+
+#include <cstddef>
+
+const size_t kNotFound = static_cast<size_t>(-1);
+
+// Offset of the first occurrence of needle[0, m) in data[0, n), or
+// kNotFound. Candidates are the positions where both the first and the
+// last byte of the needle match, found 32 or 16 at a time with AVX2 or
+// SSE2; only those are compared in full.
+size_t FindBytes(const char* data, size_t n, const char* needle, size_t m);
+
+#endif  // TEXT_EDITOR_SEARCH_H
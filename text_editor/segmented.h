@@ -0,0 +1,86 @@
+#ifndef TEXT_EDITOR_SEGMENTED_H
+#define TEXT_EDITOR_SEGMENTED_H
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+// An append-only array kept in segments of doubling size, kFirst << s
+// elements in segment s, behind a table of segments that never grows. An
+// element never moves once stored, so a thread that was handed the array
+// can read every element stored before the handover while the owner keeps
+// appending, which a reallocating std::vector would not allow. Only the
+// owner may look at Size.
+template <typename T>
+class Segmented {
+public:
+    Segmented() : size_(0), segments_used_(0) {
+    }
+
+    Segmented(const Segmented&) = delete;
+    Segmented& operator=(const Segmented&) = delete;
+
+    size_t Size() const {
+        return size_;
+    }
+
+    // Segments allocated so far.
+    size_t Segments() const {
+        return segments_used_;
+    }
+
+    const T& operator[](size_t i) const {
+        size_t s = Segment(i);
+        return segments_[s][i + kFirst - (kFirst << s)];
+    }
+
+    T& operator[](size_t i) {
+        size_t s = Segment(i);
+        return segments_[s][i + kFirst - (kFirst << s)];
+    }
+
+    void PushBack(T value) {
+        size_t s = Reserve();
+        segments_[s][size_ + kFirst - (kFirst << s)] = std::move(value);
+        ++size_;
+    }
+
+    // Appends [first, last), a segment's worth at a time.
+    template <typename It>
+    void Append(It first, It last) {
+        while (first != last) {
+            size_t s = Reserve();
+            size_t at = size_ + kFirst - (kFirst << s);
+            size_t n = std::min<size_t>((kFirst << s) - at, last - first);
+            std::copy(first, first + n, segments_[s].get() + at);
+            first += n;
+            size_ += n;
+        }
+    }
+
+private:
+    static const size_t kFirstBits = 6;
+    static const size_t kFirst = size_t(1) << kFirstBits;
+    static const size_t kSegments = sizeof(size_t) * 8 - kFirstBits;
+
+    std::unique_ptr<T[]> segments_[kSegments];
+    size_t size_;
+    size_t segments_used_;
+
+    static size_t Segment(size_t i) {
+        return sizeof(unsigned long long) * 8 - 1 - __builtin_clzll(i + kFirst) - kFirstBits;
+    }
+
+    // The segment the next element goes to, allocated if need be.
+    size_t Reserve() {
+        size_t s = Segment(size_);
+        if (!segments_[s]) {
+            segments_[s].reset(new T[kFirst << s]);
+            ++segments_used_;
+        }
+        return s;
+    }
+};
+
+#endif  // TEXT_EDITOR_SEGMENTED_H
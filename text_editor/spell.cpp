@@ -0,0 +1,398 @@
+#include "spell.h"
+
+#include <algorithm>
+#include <cstring>
+#include "utf8.h"
+
+namespace {
+
+const size_t kNoLine = static_cast<size_t>(-1);
+
+bool Ends(char c) {
+    return c == '\n' || c == '\r' || c == '/';
+}
+
+uint64_t Hash(const char* s, size_t n) {
+    uint64_t h = 14695981039346656037ull;
+    for (size_t i = 0; i < n; ++i) {
+        h ^= static_cast<unsigned char>(s[i]);
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+// Latin, Greek and Cyrillic letters; other scripts are not checked.
+bool IsLetter(uint32_t code) {
+    if (code < 0x80) {
+        return (code | 0x20) >= 'a' && (code | 0x20) <= 'z';
+    }
+    if (code >= 0xc0 && code <= 0x24f) {
+        return code != 0xd7 && code != 0xf7;
+    }
+    return code >= 0x386 && code <= 0x52f && code != 0x387;
+}
+
+uint32_t Lower(uint32_t code) {
+    if ((code >= 'A' && code <= 'Z') || (code >= 0xc0 && code <= 0xde && code != 0xd7) ||
+        (code >= 0x391 && code <= 0x3ab && code != 0x3a2) || (code >= 0x410 && code <= 0x42f)) {
+        return code + 0x20;
+    }
+    if (code >= 0x400 && code <= 0x40f) {
+        return code + 0x50;
+    }
+    return code;
+}
+
+bool IsApostrophe(uint32_t code) {
+    return code == '\'' || code == 0x2019;
+}
+
+// The word with typographic apostrophes made plain, and lowercased if
+// asked.
+void Key(const char* s, size_t n, bool lower, std::string& out) {
+    out.clear();
+    size_t i = 0;
+    while (i < n) {
+        uint32_t code;
+        size_t len = DecodeUtf8(s + i, n - i, code);
+        if (IsApostrophe(code)) {
+            out += '\'';
+        } else if (lower && Lower(code) != code) {
+            char buff[kUtf8Max];
+            out.append(buff, EncodeUtf8(Lower(code), buff));
+        } else {
+            out.append(s + i, len);
+        }
+        i += len;
+    }
+}
+
+bool Known(const Dictionary& dictionary, const std::string& key) {
+    if (dictionary.Contains(key.data(), key.size())) {
+        return true;
+    }
+    size_t n = key.size();
+    return n > 2 && key[n - 2] == '\'' && key[n - 1] == 's' && dictionary.Contains(key.data(), n - 2);
+}
+
+}  // namespace
+
+const unsigned Dictionary::kHashes;
+const size_t Dictionary::kBitsPerWord;
+
+Dictionary::Dictionary() : mask_(0) {
+}
+
+bool Dictionary::Load(const char* path) {
+    std::unique_ptr<MappedFile> file = MappedFile::Open(path);
+    if (!file || file->Size() == 0 || file->Size() > UINT32_MAX) {
+        return false;
+    }
+    const char* data = file->Data();
+    size_t size = file->Size();
+    std::vector<Word> words;
+    size_t i = 0;
+    while (i < size) {
+        const char* nl = static_cast<const char*>(memchr(data + i, '\n', size - i));
+        size_t end = nl ? nl - data : size;
+        size_t n = 0;
+        while (i + n < end && !Ends(data[i + n])) {
+            ++n;
+        }
+        if (n != 0) {
+            Word word = {static_cast<uint32_t>(i), static_cast<uint32_t>(n)};
+            words.push_back(word);
+        }
+        i = end + 1;
+    }
+    if (words.empty()) {
+        return false;
+    }
+    std::sort(words.begin(), words.end(), [data](const Word& a, const Word& b) {
+        int c = memcmp(data + a.offset, data + b.offset, std::min(a.length, b.length));
+        return c != 0 ? c < 0 : a.length < b.length;
+    });
+    size_t bits = 64;
+    while (bits < words.size() * kBitsPerWord) {
+        bits <<= 1;
+    }
+    std::vector<uint64_t> bloom(bits / 64);
+    uint64_t mask = bits - 1;
+    for (const Word& word : words) {
+        uint64_t h = Hash(data + word.offset, word.length);
+        uint64_t step = (h >> 32) | 1;
+        for (unsigned k = 0; k < kHashes; ++k, h += step) {
+            bloom[(h & mask) >> 6] |= uint64_t(1) << (h & 63);
+        }
+    }
+    file_ = std::move(file);
+    words_.swap(words);
+    bloom_.swap(bloom);
+    mask_ = mask;
+    return true;
+}
+
+size_t Dictionary::Size() const {
+    return words_.size();
+}
+
+bool Dictionary::Contains(const char* word, size_t n) const {
+    if (words_.empty()) {
+        return false;
+    }
+    uint64_t h = Hash(word, n);
+    uint64_t step = (h >> 32) | 1;
+    for (unsigned k = 0; k < kHashes; ++k, h += step) {
+        if (!(bloom_[(h & mask_) >> 6] & (uint64_t(1) << (h & 63)))) {
+            return false;
+        }
+    }
+    const char* data = file_->Data();
+    std::vector<Word>::const_iterator it = std::lower_bound(
+        words_.begin(), words_.end(), n, [data, word](const Word& a, size_t length) {
+            int c = memcmp(data + a.offset, word, std::min<size_t>(a.length, length));
+            return c != 0 ? c < 0 : a.length < length;
+        });
+    return it != words_.end() && it->length == n && memcmp(data + it->offset, word, n) == 0;
+}
+
+const size_t SpellChecker::kMaxLine;
+const size_t SpellChecker::kCachedLines;
+
+SpellChecker::SpellChecker()
+    : cache_(kCachedLines), outstanding_(0), started_(false), failed_(false), stop_(false) {
+    for (Entry& entry : cache_) {
+        entry.line = kNoLine;
+        entry.version = 0;
+        entry.checked = false;
+        entry.queued = false;
+    }
+}
+
+SpellChecker::~SpellChecker() {
+    if (worker_.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        wake_.notify_one();
+        worker_.join();
+    }
+}
+
+void SpellChecker::Start(const std::string& path) {
+    if (started_) {
+        return;
+    }
+    path_ = path;
+    started_ = true;
+    worker_ = std::thread(&SpellChecker::Work, this);
+}
+
+// True from Start on, until the worker fails to load the dictionary.
+bool SpellChecker::Enabled() const {
+    return started_ && !failed_;
+}
+
+void SpellChecker::Clear() {
+    for (Entry& entry : cache_) {
+        ++entry.version;
+        entry.checked = false;
+        entry.queued = false;
+        entry.spans.clear();
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    outstanding_ -= jobs_.size();
+    jobs_.clear();
+}
+
+// An edit from byte x of line to line last, numbered as after it, that
+// added (lines > 0) or removed line breaks. A word that ends at x may have
+// grown, so only the ones before it stay.
+void SpellChecker::Edit(size_t line, size_t x, size_t last, long lines) {
+    for (Entry& entry : cache_) {
+        if (entry.line == line) {
+            while (!entry.spans.empty() && entry.spans.back().start + entry.spans.back().length >= x) {
+                entry.spans.pop_back();
+            }
+        } else if ((lines != 0 || entry.line <= last) && entry.line > line && entry.line != kNoLine) {
+            entry.spans.clear();
+        } else {
+            continue;
+        }
+        ++entry.version;
+        entry.checked = false;
+        entry.queued = false;
+    }
+}
+
+// Whether line y has neither been checked since its last edit nor been
+// queued for it.
+bool SpellChecker::Needs(size_t y) const {
+    const Entry& entry = cache_[y % kCachedLines];
+    return entry.line != y || (!entry.checked && !entry.queued);
+}
+
+// Queues bytes [start, start + n) of text, the first bytes of line y, or
+// all of them when whole. Only the prose spans of them are checked; the
+// rest is blanked out. Jobs queued earlier for the cache entry are stale
+// and go.
+void SpellChecker::Check(size_t y, PieceTable::Snapshot text, size_t start, size_t n, bool whole,
+                         std::vector<Span> prose, bool urgent) {
+    Entry& entry = cache_[y % kCachedLines];
+    if (entry.line != y) {
+        entry.line = y;
+        entry.checked = false;
+        entry.spans.clear();
+    }
+    ++entry.version;
+    entry.queued = true;
+    Job job = {y, entry.version, whole, std::move(text), start, n, std::move(prose)};
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (std::deque<Job>::iterator it = jobs_.begin(); it != jobs_.end();) {
+            if (it->line % kCachedLines == y % kCachedLines) {
+                it = jobs_.erase(it);
+                --outstanding_;
+            } else {
+                ++it;
+            }
+        }
+        if (urgent) {
+            jobs_.push_front(std::move(job));
+        } else {
+            jobs_.push_back(std::move(job));
+        }
+        ++outstanding_;
+    }
+    wake_.notify_one();
+}
+
+// Misspelled words of line y as of its last check; after an edit, only the
+// ones before it until the line is checked again.
+const std::vector<SpellChecker::Span>& SpellChecker::Spans(size_t y) const {
+    static const std::vector<Span> kNone;
+    const Entry& entry = cache_[y % kCachedLines];
+    return entry.line == y ? entry.spans : kNone;
+}
+
+bool SpellChecker::Pending() const {
+    return Enabled() && outstanding_ != 0;
+}
+
+// Takes the results the worker has finished and appends the lines whose
+// words changed.
+size_t SpellChecker::Poll(std::vector<size_t>& lines) {
+    std::vector<Result> results;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        results.swap(results_);
+    }
+    size_t count = lines.size();
+    for (Result& result : results) {
+        --outstanding_;
+        Entry& entry = cache_[result.line % kCachedLines];
+        if (entry.line != result.line || entry.version != result.version) {
+            continue;
+        }
+        entry.checked = true;
+        entry.queued = false;
+        entry.spans.swap(result.spans);
+        lines.push_back(result.line);
+    }
+    return lines.size() - count;
+}
+
+void SpellChecker::Work() {
+    if (!dictionary_.Load(path_.c_str())) {
+        failed_ = true;
+        return;
+    }
+    std::string text;
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        wake_.wait(lock, [this] { return stop_ || !jobs_.empty(); });
+        if (stop_) {
+            return;
+        }
+        Job job = std::move(jobs_.front());
+        jobs_.pop_front();
+        lock.unlock();
+        text.clear();
+        job.text.Copy(job.start, job.n, text);
+        size_t at = 0;
+        for (const Span& span : job.prose) {
+            std::fill(text.begin() + std::min(at, job.n), text.begin() + std::min(span.start, job.n), ' ');
+            at = span.start + span.length;
+        }
+        std::fill(text.begin() + std::min(at, job.n), text.end(), ' ');
+        Result result = {job.line, job.version, std::vector<Span>()};
+        Misspelled(dictionary_, text.data(), text.size(), job.whole, result.spans);
+        lock.lock();
+        results_.push_back(std::move(result));
+    }
+}
+
+void SpellChecker::Misspelled(const Dictionary& dictionary, const char* text, size_t n, bool whole,
+                              std::vector<Span>& out) {
+    std::string key;
+    size_t i = 0;
+    while (i < n) {
+        uint32_t code;
+        size_t len = DecodeUtf8(text + i, n - i, code);
+        if (!IsLetter(code)) {
+            i += len;
+            continue;
+        }
+        // A letter after a backslash or a percent sign is an escape or a
+        // conversion, and the word is whatever follows it.
+        size_t start = i;
+        if (start != 0 && (text[start - 1] == '\\' || text[start - 1] == '%')) {
+            start += len;
+        }
+        size_t end = i;
+        size_t letters = 0;
+        size_t upper = 0;
+        bool name = false;
+        bool capital = false;
+        while (i < n) {
+            len = DecodeUtf8(text + i, n - i, code);
+            if (IsLetter(code)) {
+                if (i >= start) {
+                    ++letters;
+                    if (Lower(code) != code) {
+                        capital = capital || letters == 1;
+                        ++upper;
+                    }
+                }
+            } else if ((code >= '0' && code <= '9') || code == '_') {
+                name = true;
+            } else if (IsApostrophe(code) && i + len < n) {
+                uint32_t next;
+                DecodeUtf8(text + i + len, n - i - len, next);
+                if (!IsLetter(next)) {
+                    break;
+                }
+            } else {
+                break;
+            }
+            i += len;
+            end = i;
+        }
+        if (name || letters < 2 || upper > 1 || (upper == 1 && !capital) || (!whole && end == n)) {
+            continue;
+        }
+        Key(text + start, end - start, false, key);
+        if (Known(dictionary, key)) {
+            continue;
+        }
+        if (upper == 1) {
+            Key(text + start, end - start, true, key);
+            if (Known(dictionary, key)) {
+                continue;
+            }
+        }
+        Span span = {start, end - start};
+        out.push_back(span);
+    }
+}
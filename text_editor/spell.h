@@ -0,0 +1,128 @@
+#ifndef TEXT_EDITOR_SPELL_H
+#define TEXT_EDITOR_SPELL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "mapped_file.h"
+#include "piece_table.h"
+
+// A word list, one word per line, mapped rather than read. A word ends at
+// a line break or at '/', so hunspell .dic files work too, minus their
+// affixes. Loading sorts the offsets of the words and sets the bits of a
+// Bloom filter; a lookup the filter rejects, which is what most misspelled
+// words get, costs a few bit tests, and one it passes is settled by binary
+// search over the sorted words.
+class Dictionary {
+public:
+    Dictionary();
+
+    bool Load(const char* path);
+    size_t Size() const;
+    bool Contains(const char* word, size_t n) const;
+
+private:
+    struct Word {
+        uint32_t offset;
+        uint32_t length;
+    };
+
+    static const unsigned kHashes = 7;
+    static const size_t kBitsPerWord = 10;
+
+    std::unique_ptr<MappedFile> file_;
+    std::vector<Word> words_;
+    std::vector<uint64_t> bloom_;
+    uint64_t mask_;
+};
+
+// Finds the words of lines that the dictionary lacks, on a worker thread
+// that also loads the dictionary. The editing thread queues a snapshot of
+// the text and where the line is in it, and the worker copies the line out
+// itself. Lines on screen are queued ahead of the rest.
+//
+// Results are cached by line number. An edit keeps the words of its line
+// that end before it, and drops the lines below it only when it adds or
+// removes line breaks. Every entry has a version that an edit bumps, and a
+// result for an older version than the entry's is dropped.
+class SpellChecker {
+public:
+    struct Span {
+        size_t start;
+        size_t length;
+    };
+
+    static const size_t kMaxLine = 1 << 16;
+
+    SpellChecker();
+    SpellChecker(const SpellChecker&) = delete;
+    SpellChecker& operator=(const SpellChecker&) = delete;
+    ~SpellChecker();
+
+    void Start(const std::string& path);
+    bool Enabled() const;
+    void Clear();
+    void Edit(size_t line, size_t x, size_t last, long lines);
+    bool Needs(size_t y) const;
+    void Check(size_t y, PieceTable::Snapshot text, size_t start, size_t n, bool whole,
+               std::vector<Span> prose, bool urgent);
+    const std::vector<Span>& Spans(size_t y) const;
+    bool Pending() const;
+    size_t Poll(std::vector<size_t>& lines);
+
+    // Misspelled words of text[0, n). Words with digits or underscores,
+    // acronyms and camelCase are taken for names, and a word that runs into
+    // the end of a text that is not whole is left alone.
+    static void Misspelled(const Dictionary&, const char* text, size_t n, bool whole, std::vector<Span>& out);
+
+private:
+    struct Entry {
+        size_t line;
+        unsigned version;
+        bool checked;
+        bool queued;
+        std::vector<Span> spans;
+    };
+
+    struct Job {
+        size_t line;
+        unsigned version;
+        bool whole;
+        PieceTable::Snapshot text;
+        size_t start;
+        size_t n;
+        std::vector<Span> prose;
+    };
+
+    struct Result {
+        size_t line;
+        unsigned version;
+        std::vector<Span> spans;
+    };
+
+    static const size_t kCachedLines = 1024;
+
+    std::string path_;
+    Dictionary dictionary_;
+    std::vector<Entry> cache_;
+    size_t outstanding_;
+    bool started_;
+    std::atomic<bool> failed_;
+    std::atomic<bool> stop_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::deque<Job> jobs_;
+    std::vector<Result> results_;
+    std::thread worker_;
+
+    void Work();
+};
+
+#endif  // TEXT_EDITOR_SPELL_H
@@ -3,35 +3,67 @@
 Cursor cur;
 
 TextEditor::TextEditor() {
-    if (text_.empty()) {
-        text_.resize(1);
+}
+
+IAction* ActionHistory::At(size_t offset) {
+    return reinterpret_cast<IAction*>(&log_[offset]);
+}
+
+IAction* ActionHistory::Top() {
+    if (done_ == 0) {
+        return nullptr;
     }
+    return At(done_ - (done_ == size_ ? last_ : At(done_)->Prev));
+}
+
+IAction* ActionHistory::Next() {
+    return done_ == size_ ? nullptr : At(done_);
 }
 
-ActionHistory::~ActionHistory() {
-    while (!for_undo.empty()) {
-        delete for_undo.top();
-        for_undo.pop();
+char* ActionHistory::Reserve(size_t size) {
+    if (size_ + size > log_.size()) {
+        log_.resize(std::max(2 * log_.size(), size_ + size));
+        ++allocations_;
     }
-    while (!for_redo.empty()) {
-        delete for_redo.top();
-        for_redo.pop();
+    return &log_[size_];
+}
+
+void ActionHistory::Truncate() {
+    if (done_ != size_) {
+        last_ = At(done_)->Prev;
+        size_ = done_;
     }
 }
 
+size_t ActionHistory::Allocations() const {
+    return allocations_;
+}
+
+size_t TextEditor::Offset() {
+    return text_.LineStart(cur_.y_) + cur_.x_;
+}
+
+Cursor TextEditor::Clamp(const Cursor& cursor) {
+    Cursor clamped;
+    clamped.y_ = std::min(cursor.y_, text_.LineCount() - 1);
+    clamped.x_ = std::min(cursor.x_, text_.LineLength(clamped.y_));
+    return clamped;
+}
+
 void TextEditor::ShiftLeft() {
     if (cur_.x_ != 0) {
         --cur_.x_;
     } else if (cur_.y_ > 0) {
         --cur_.y_;
-        cur_.x_ = text_[cur_.y_].size();
+        cur_.x_ = text_.LineLength(cur_.y_);
     }
 }
 
 void TextEditor::ShiftRight() {
-    if (cur_.y_ < text_.size() && cur_.x_ < text_[cur_.y_].size()) {
+    size_t len = text_.LineLength(cur_.y_);
+    if (cur_.x_ < len) {
         ++cur_.x_;
-    } else if (cur_.y_ < text_.size() - 1 && text_[cur_.y_].size() == cur_.x_) {
+    } else if (cur_.y_ + 1 < text_.LineCount() && len == cur_.x_) {
         ++cur_.y_;
         cur_.x_ = 0;
     }
@@ -40,64 +72,117 @@ void TextEditor::ShiftRight() {
 void TextEditor::ShiftUp() {
     if (cur_.y_ != 0) {
         --cur_.y_;
-        if (cur_.y_ < text_.size() && cur_.x_ > text_[cur_.y_].size()) {
-            cur_.x_ = text_[cur_.y_].size();
+        size_t len = text_.LineLength(cur_.y_);
+        if (cur_.x_ > len) {
+            cur_.x_ = len;
         }
     }
 }
 
 void TextEditor::ShiftDown() {
-    if (cur_.y_ < text_.size() - 1) {
+    if (cur_.y_ + 1 < text_.LineCount()) {
         ++cur_.y_;
-        if (cur_.y_ < text_.size() && cur_.x_ > (text_[cur_.y_].size())) {
-            cur_.x_ = text_[cur_.y_].size();
+        size_t len = text_.LineLength(cur_.y_);
+        if (cur_.x_ > len) {
+            cur_.x_ = len;
         }
     }
 }
 
 void TextEditor::CheckRedo() {
-    while (!storage_.for_redo.empty()) {
-        delete storage_.for_redo.top();
-        storage_.for_redo.pop();
-    }
+    storage_.Truncate();
 }
 
 void TextEditor::Delete() {
     CheckRedo();
-    IAction* a = new IAction(DelAction());
-    a->Do(this);
+    Cursor at = cur_;
+    char symbol = Delete(cur_);
+    if (symbol != '\0') {
+        RecordDelete(at, symbol, false);
+    }
 }
 
 void TextEditor::BackSpace() {
     CheckRedo();
-    IAction* a = new IAction(BackAction());
-    a->Do(this);
+    Cursor at = cur_;
+    char symbol = BackSpace(cur_);
+    if (symbol != '\0') {
+        RecordDelete(at, symbol, true);
+    }
 }
 
 void TextEditor::PasteNewLine() {
-    CheckRedo();
-    IAction* a = new IAction(NewLineAction());
-    a->Do(this);
+    Type('\n');
 }
 
 void TextEditor::Type(char symbol) {
     CheckRedo();
-    IAction* a = new IAction(TypeAction(symbol));
+    Cursor from = cur_;
+    Type(symbol, cur_);
+    InsertRangeAction* run = storage_.Last<InsertRangeAction>();
+    if (run != nullptr && run->Continues(from)) {
+        run = storage_.Extend<InsertRangeAction>(run->Length(), &symbol, 1);
+        run->Append(cur_, 1);
+    } else {
+        storage_.Emplace(InsertRangeAction(from, cur_, 1), &symbol, 1);
+        storage_.done_ = storage_.size_;
+    }
+}
+
+void TextEditor::InsertText(const std::string& text, const Cursor& at) {
+    ReplaceRange(at, at, text);
+}
+
+void TextEditor::DeleteRange(const Cursor& from, const Cursor& to) {
+    ReplaceRange(from, to, std::string());
+}
+
+// Edits the piece table once for the whole range, whatever number of lines
+// it spans, and records a single ReplaceRangeAction.
+void TextEditor::ReplaceRange(const Cursor& from, const Cursor& to, const std::string& text) {
+    Cursor first = Clamp(from);
+    Cursor last = Clamp(to);
+    size_t begin = text_.LineStart(first.y_) + first.x_;
+    size_t end = text_.LineStart(last.y_) + last.x_;
+    if (end < begin) {
+        std::swap(begin, end);
+        std::swap(first, last);
+    }
+    if (begin == end && text.empty()) {
+        return;
+    }
+    CheckRedo();
+    std::string tail;
+    text_.Copy(begin, end - begin, tail);
+    tail += text;
+    IAction* a = storage_.Emplace(ReplaceRangeAction(first, end - begin, text.size()), tail.data(), tail.size());
     a->Do(this);
 }
 
+void TextEditor::RecordDelete(const Cursor& at, char symbol, bool backward) {
+    DeleteRangeAction* run = storage_.Last<DeleteRangeAction>();
+    if (run != nullptr && run->Continues(at, backward)) {
+        run = storage_.Extend<DeleteRangeAction>(run->Length(), &symbol, 1);
+        run->Append(cur_, 1);
+    } else {
+        storage_.Emplace(DeleteRangeAction(cur_, 1, backward), &symbol, 1);
+        storage_.done_ = storage_.size_;
+    }
+}
+
 char TextEditor::Delete(Cursor& cursor) {
     if (cursor != cur) {
         cur_ = cursor;
     }
     char symbol_ = '\0';
-    if (cur_.x_ < text_[cur_.y_].size()) {
-        symbol_ = text_[cur_.y_][cur_.x_];
-        text_[cur_.y_].erase(cur_.x_, 1);
-    } else if (cur_.y_ < text_.size() - 1) {
+    size_t len = text_.LineLength(cur_.y_);
+    if (cur_.x_ < len) {
+        size_t offset = Offset();
+        symbol_ = text_.At(offset);
+        text_.Erase(offset, 1);
+    } else if (cur_.y_ + 1 < text_.LineCount()) {
         symbol_ = '\n';
-        text_[cur_.y_] += text_[cur_.y_ + 1];
-        text_.erase(text_.begin() + cur_.y_ + 1);
+        text_.Erase(text_.LineStart(cur_.y_) + len, 1);
     }
     cursor = cur_;
     return symbol_;
@@ -109,14 +194,14 @@ char TextEditor::BackSpace(Cursor& cursor) {
     }
     char symbol_ = '\0';
     if (cur_.x_ > 0) {
-        symbol_ = text_[cur_.y_][cur_.x_ - 1];
-        text_[cur_.y_].erase(cur_.x_ - 1, 1);
+        size_t offset = Offset() - 1;
+        symbol_ = text_.At(offset);
+        text_.Erase(offset, 1);
         ShiftLeft();
     } else if (cur_.y_ > 0) {
         --cur_.y_;
-        cur_.x_ = text_[cur_.y_].size();
-        text_[cur_.y_] += text_[cur_.y_ + 1];
-        text_.erase(text_.begin() + cur_.y_ + 1);
+        cur_.x_ = text_.LineLength(cur_.y_);
+        text_.Erase(Offset(), 1);
         symbol_ = '\n';
     }
     cursor = cur_;
@@ -127,8 +212,7 @@ void TextEditor::PasteNewLine(Cursor& cursor) {
     if (cursor != cur) {
         cur_ = cursor;
     }
-    text_.insert(text_.begin() + cur_.y_ + 1, text_[cur_.y_].substr(cur_.x_, text_[cur_.y_].size() - cur_.x_));
-    text_[cur_.y_].resize(cur_.x_);
+    text_.Insert(Offset(), "\n", 1);
     cur_.y_++;
     cur_.x_ = 0;
     cursor = cur_;
@@ -139,9 +223,8 @@ void TextEditor::ReverseNewLine(Cursor& cursor) {
         cur_ = cursor;
     }
     --cur_.y_;
-    cur_.x_ = text_[cur_.y_].size();
-    text_[cur_.y_] += text_[cur_.y_ + 1];
-    text_.erase(text_.begin() + cur_.y_ + 1);
+    cur_.x_ = text_.LineLength(cur_.y_);
+    text_.Erase(Offset(), 1);
     cursor = cur_;
 }
 
@@ -149,37 +232,51 @@ void TextEditor::Type(char symbol, Cursor& cursor) {
     if (cursor != cur) {
         cur_ = cursor;
     }
+    text_.Insert(Offset(), &symbol, 1);
     if (symbol == '\n') {
-        text_.insert(text_.begin() + cur_.y_ + 1, text_[cur_.y_].substr(cur_.x_, text_[cur_.y_].size() - cur_.x_));
-        text_[cur_.y_].resize(cur_.x_);
         cur_.y_++;
         cur_.x_ = 0;
     } else {
-        text_[cur_.y_].insert(cur_.x_, std::string(1, symbol));
         ShiftRight();
     }
     cursor = cur_;
 }
 
+void TextEditor::Type(const char* text, size_t n, Cursor& cursor) {
+    cur_ = cursor;
+    text_.Insert(Offset(), text, n);
+    const char* last = std::find(std::reverse_iterator<const char*>(text + n),
+                                 std::reverse_iterator<const char*>(text), '\n').base();
+    if (last == text) {
+        cur_.x_ += n;
+    } else {
+        cur_.y_ += std::count(text, last, '\n');
+        cur_.x_ = text + n - last;
+    }
+    cursor = cur_;
+}
+
+void TextEditor::Erase(size_t n, Cursor& cursor) {
+    cur_ = cursor;
+    text_.Erase(Offset(), n);
+}
+
 void TextEditor::Undo() {
-    if (!storage_.for_undo.empty()) {
-        storage_.for_undo.top()->Undo(this);
-        storage_.for_undo.pop();
+    if (IAction* a = storage_.Top()) {
+        a->Undo(this);
     }
 }
 
 void TextEditor::Redo() {
-    if (!storage_.for_redo.empty()) {
-        storage_.for_redo.top()->Do(this);
-        storage_.for_redo.pop();
+    if (IAction* a = storage_.Next()) {
+        a->Do(this);
     }
 }
 
+size_t TextEditor::Allocations() const {
+    return text_.Allocations() + storage_.Allocations();
+}
+
 void TextEditor::Print(std::ostream& os) const {
-    for (size_t i = 0; i < text_.size(); ++i) {
-        os << text_[i];
-        if (i + 1 != text_.size()) {
-            os << '\n';
-        }
-    }
+    text_.Print(os);
 }
\ No newline at end of file
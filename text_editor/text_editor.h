@@ -1,21 +1,79 @@
 #ifndef TEXT_EDITOR_TEXT_EDITOR_H
 #define TEXT_EDITOR_TEXT_EDITOR_H
 
-#include <stack>
+#include <algorithm>
+#include <new>
 #include <string>
 #include <vector>
 #include <iostream>
 #include <sstream>
 #include <actions.h>
+#include <piece_table.h>
 
+// Actions are packed into one byte log in the order they were done, each
+// taking only a header and its own size: bytes [0, done_) can be undone and
+// [done_, size_) redone. Dropping the redo branch just moves size_ back, so
+// actions stored here must be trivially copyable.
 struct ActionHistory {
-    std::stack<IAction*> for_undo;
-    std::stack<IAction*> for_redo;
-    ~ActionHistory();
+    static const size_t kAlign = alignof(IAction);
+    std::vector<char> log_;
+    size_t done_ = 0;
+    size_t size_ = 0;
+    size_t last_ = 0;
+    size_t allocations_ = 0;
+
+    IAction* At(size_t);
+    IAction* Top();
+    IAction* Next();
+    char* Reserve(size_t);
+    template <typename TBaser>
+    IAction* Emplace(TBaser r, const char* tail = nullptr, size_t n = 0) {
+        static_assert(std::is_trivially_copyable<TBaser>::value, "action must be trivially copyable");
+        static_assert(alignof(TBaser) <= kAlign, "action is overaligned");
+        size_t size = (sizeof(IAction) + sizeof(TBaser) + n + kAlign - 1) / kAlign * kAlign;
+        IAction* action = reinterpret_cast<IAction*>(Reserve(size));
+        action->Descriptor = Describe<TBaser>();
+        action->Size = size;
+        action->Prev = last_;
+        new (action->OperStorage()) TBaser(r);
+        std::copy(tail, tail + n, action->OperStorage() + sizeof(TBaser));
+        size_ += size;
+        last_ = size;
+        return action;
+    }
+    // The last record if it is done and holds a TBaser, for coalescing.
+    template <typename TBaser>
+    TBaser* Last() {
+        IAction* top = done_ == size_ ? Top() : nullptr;
+        if (top == nullptr || top->Descriptor != Describe<TBaser>()) {
+            return nullptr;
+        }
+        return reinterpret_cast<TBaser*>(top->OperStorage());
+    }
+    // Appends n tail bytes to the last record, whose tail already has used.
+    template <typename TBaser>
+    TBaser* Extend(size_t used, const char* tail, size_t n) {
+        size_t start = size_ - last_;
+        size_t size = (sizeof(IAction) + sizeof(TBaser) + used + n + kAlign - 1) / kAlign * kAlign;
+        if (size > last_) {
+            Reserve(size - last_);
+            At(start)->Size = size;
+            size_ = done_ = start + size;
+            last_ = size;
+        }
+        char* storage = At(start)->OperStorage();
+        std::copy(tail, tail + n, storage + sizeof(TBaser) + used);
+        return reinterpret_cast<TBaser*>(storage);
+    }
+    void Truncate();
+    size_t Allocations() const;
 };
 
 class TextEditor {
-    std::vector<std::string> text_;
+    PieceTable text_;
+    size_t Offset();
+    Cursor Clamp(const Cursor&);
+    void RecordDelete(const Cursor&, char, bool);
 
 public:
     ActionHistory storage_;
@@ -29,15 +87,21 @@ public:
     void Delete();
     void BackSpace();
     void PasteNewLine();
+    void InsertText(const std::string&, const Cursor&);
+    void DeleteRange(const Cursor&, const Cursor&);
+    void ReplaceRange(const Cursor&, const Cursor&, const std::string&);
     char Delete(Cursor&);
     char BackSpace(Cursor&);
     void ReverseNewLine(Cursor&);
     void PasteNewLine(Cursor&);
     void Type(char, Cursor&);
+    void Type(const char*, size_t, Cursor&);
+    void Erase(size_t, Cursor&);
     void Undo();
     void Redo();
     void Print(std::ostream& os) const;
     void CheckRedo();
+    size_t Allocations() const;
 };
 
 #endif  // TEXT_EDITOR_TEXT_EDITOR_H
\ No newline at end of file
@@ -0,0 +1,181 @@
+#include "utf8.h"
+
+#if defined(__GNUC__) && defined(__SSE2__)
+#include <immintrin.h>
+#define UTF8_X86
+#endif
+
+namespace {
+
+#ifdef UTF8_X86
+// A signed compare against 0x1f rejects the controls and every byte from
+// 0x80 up, which leaves DEL to be rejected on its own.
+size_t PlainSse2(const char* data, size_t n) {
+    const __m128i space = _mm_set1_epi8(0x1f);
+    const __m128i del = _mm_set1_epi8(0x7f);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        __m128i plain = _mm_andnot_si128(_mm_cmpeq_epi8(block, del), _mm_cmpgt_epi8(block, space));
+        unsigned mask = ~_mm_movemask_epi8(plain) & 0xffff;
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return i;
+}
+
+__attribute__((target("avx2"))) size_t PlainAvx2(const char* data, size_t n) {
+    const __m256i space = _mm256_set1_epi8(0x1f);
+    const __m256i del = _mm256_set1_epi8(0x7f);
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        __m256i plain = _mm256_andnot_si256(_mm256_cmpeq_epi8(block, del), _mm256_cmpgt_epi8(block, space));
+        unsigned mask = ~static_cast<unsigned>(_mm256_movemask_epi8(plain));
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return i;
+}
+#endif
+
+// Ranges are inclusive and sorted.
+const uint32_t kCombining[][2] = {
+    {0x0300, 0x036f}, {0x0483, 0x0489}, {0x0591, 0x05bd}, {0x0610, 0x061a}, {0x064b, 0x065f},
+    {0x0e31, 0x0e31}, {0x0e34, 0x0e3a}, {0x0e47, 0x0e4e}, {0x1ab0, 0x1aff}, {0x1dc0, 0x1dff},
+    {0x200b, 0x200d}, {0x20d0, 0x20ff}, {0xfe00, 0xfe0f}, {0xfe20, 0xfe2f}, {0xe0100, 0xe01ef}};
+
+// East_Asian_Width W and F as of Unicode 14.0, which takes in the emoji
+// with default emoji presentation; unassigned code points between two wide
+// ranges count as wide.
+const uint32_t kWide[][2] = {
+    {0x1100, 0x115f}, {0x231a, 0x231b}, {0x2329, 0x232a}, {0x23e9, 0x23ec}, {0x23f0, 0x23f0},
+    {0x23f3, 0x23f3}, {0x25fd, 0x25fe}, {0x2614, 0x2615}, {0x2648, 0x2653}, {0x267f, 0x267f},
+    {0x2693, 0x2693}, {0x26a1, 0x26a1}, {0x26aa, 0x26ab}, {0x26bd, 0x26be}, {0x26c4, 0x26c5},
+    {0x26ce, 0x26ce}, {0x26d4, 0x26d4}, {0x26ea, 0x26ea}, {0x26f2, 0x26f3}, {0x26f5, 0x26f5},
+    {0x26fa, 0x26fa}, {0x26fd, 0x26fd}, {0x2705, 0x2705}, {0x270a, 0x270b}, {0x2728, 0x2728},
+    {0x274c, 0x274c}, {0x274e, 0x274e}, {0x2753, 0x2755}, {0x2757, 0x2757}, {0x2795, 0x2797},
+    {0x27b0, 0x27b0}, {0x27bf, 0x27bf}, {0x2b1b, 0x2b1c}, {0x2b50, 0x2b50}, {0x2b55, 0x2b55},
+    {0x2e80, 0x303e}, {0x3041, 0x3247}, {0x3250, 0x4dbf}, {0x4e00, 0xa4c6}, {0xa960, 0xa97c},
+    {0xac00, 0xd7a3}, {0xf900, 0xfaff}, {0xfe10, 0xfe19}, {0xfe30, 0xfe6b}, {0xff01, 0xff60},
+    {0xffe0, 0xffe6}, {0x16fe0, 0x18d08}, {0x1aff0, 0x1b2fb}, {0x1f004, 0x1f004}, {0x1f0cf, 0x1f0cf},
+    {0x1f18e, 0x1f18e}, {0x1f191, 0x1f19a}, {0x1f200, 0x1f320}, {0x1f32d, 0x1f335}, {0x1f337, 0x1f37c},
+    {0x1f37e, 0x1f393}, {0x1f3a0, 0x1f3ca}, {0x1f3cf, 0x1f3d3}, {0x1f3e0, 0x1f3f0}, {0x1f3f4, 0x1f3f4},
+    {0x1f3f8, 0x1f43e}, {0x1f440, 0x1f440}, {0x1f442, 0x1f4fc}, {0x1f4ff, 0x1f53d}, {0x1f54b, 0x1f54e},
+    {0x1f550, 0x1f567}, {0x1f57a, 0x1f57a}, {0x1f595, 0x1f596}, {0x1f5a4, 0x1f5a4}, {0x1f5fb, 0x1f64f},
+    {0x1f680, 0x1f6c5}, {0x1f6cc, 0x1f6cc}, {0x1f6d0, 0x1f6d2}, {0x1f6d5, 0x1f6df}, {0x1f6eb, 0x1f6ec},
+    {0x1f6f4, 0x1f6fc}, {0x1f7e0, 0x1f7f0}, {0x1f90c, 0x1f93a}, {0x1f93c, 0x1f945}, {0x1f947, 0x1f9ff},
+    {0x1fa70, 0x1faf6}, {0x20000, 0x3fffd}};
+
+template <size_t N>
+bool InRanges(const uint32_t (&ranges)[N][2], uint32_t code) {
+    if (code < ranges[0][0]) {
+        return false;
+    }
+    size_t lo = 0;
+    size_t hi = N;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (ranges[mid][1] < code) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo < N && ranges[lo][0] <= code;
+}
+
+}  // namespace
+
+size_t Utf8Length(unsigned char lead) {
+    if (lead < 0x80) {
+        return 1;
+    }
+    if (lead < 0xc2) {
+        return 0;
+    }
+    if (lead < 0xe0) {
+        return 2;
+    }
+    if (lead < 0xf0) {
+        return 3;
+    }
+    return lead < 0xf5 ? 4 : 0;
+}
+
+size_t PlainPrefix(const char* data, size_t n) {
+    size_t i = 0;
+#ifdef UTF8_X86
+    static const bool avx2 = (__builtin_cpu_init(), __builtin_cpu_supports("avx2"));
+    i = avx2 ? PlainAvx2(data, n) : PlainSse2(data, n);
+#endif
+    while (i < n && data[i] >= 0x20 && data[i] < 0x7f) {
+        ++i;
+    }
+    return i;
+}
+
+size_t DecodeUtf8(const char* s, size_t n, uint32_t& code) {
+    const unsigned char* u = reinterpret_cast<const unsigned char*>(s);
+    size_t len = Utf8Length(u[0]);
+    code = kReplacement;
+    if (len == 1) {
+        code = u[0];
+        return 1;
+    }
+    if (len == 0 || len > n) {
+        return 1;
+    }
+    // The second byte narrows the range for the leads that could otherwise
+    // encode overlong forms, surrogates or values past U+10FFFF.
+    unsigned char low = u[0] == 0xe0 ? 0xa0 : u[0] == 0xf0 ? 0x90 : 0x80;
+    unsigned char high = u[0] == 0xed ? 0x9f : u[0] == 0xf4 ? 0x8f : 0xbf;
+    if (u[1] < low || u[1] > high) {
+        return 1;
+    }
+    uint32_t value = u[0] & (0x7f >> len);
+    for (size_t i = 1; i < len; ++i) {
+        if (!IsContinuation(s[i])) {
+            return 1;
+        }
+        value = value << 6 | (u[i] & 0x3f);
+    }
+    code = value;
+    return len;
+}
+
+size_t EncodeUtf8(uint32_t code, char* out) {
+    if (code > 0x10ffff || (code >= 0xd800 && code <= 0xdfff)) {
+        code = kReplacement;
+    }
+    if (code < 0x80) {
+        out[0] = static_cast<char>(code);
+        return 1;
+    }
+    if (code < 0x800) {
+        out[0] = static_cast<char>(0xc0 | code >> 6);
+        out[1] = static_cast<char>(0x80 | (code & 0x3f));
+        return 2;
+    }
+    if (code < 0x10000) {
+        out[0] = static_cast<char>(0xe0 | code >> 12);
+        out[1] = static_cast<char>(0x80 | (code >> 6 & 0x3f));
+        out[2] = static_cast<char>(0x80 | (code & 0x3f));
+        return 3;
+    }
+    out[0] = static_cast<char>(0xf0 | code >> 18);
+    out[1] = static_cast<char>(0x80 | (code >> 12 & 0x3f));
+    out[2] = static_cast<char>(0x80 | (code >> 6 & 0x3f));
+    out[3] = static_cast<char>(0x80 | (code & 0x3f));
+    return 4;
+}
+
+bool IsCombining(uint32_t code) {
+    return InRanges(kCombining, code);
+}
+
+bool IsWide(uint32_t code) {
+    return InRanges(kWide, code);
+}
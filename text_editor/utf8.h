@@ -0,0 +1,38 @@
+#ifndef TEXT_EDITOR_UTF8_H
+#define TEXT_EDITOR_UTF8_H
+
+#include <cstddef>
+#include <cstdint>
+
+// UTF-8 decoding that never rejects input: a byte that does not start a
+// well-formed sequence (overlong forms, surrogates and code points past
+// U+10FFFF included) decodes on its own as kReplacement.
+const size_t kUtf8Max = 4;
+const uint32_t kReplacement = 0xFFFD;
+
+// Length of the sequence a lead byte announces, or 0 for a byte that
+// cannot start one.
+size_t Utf8Length(unsigned char lead);
+
+inline bool IsContinuation(char c) {
+    return (static_cast<unsigned char>(c) & 0xc0) == 0x80;
+}
+
+// Number of leading printable ASCII bytes (0x20 to 0x7e) of data. Uses
+// AVX2 or SSE2 when available and plain bytes otherwise.
+size_t PlainPrefix(const char* data, size_t n);
+
+// Decodes the character at s[0] and returns its length in bytes; 1 and
+// kReplacement for a malformed byte. n must be at least 1.
+size_t DecodeUtf8(const char* s, size_t n, uint32_t& code);
+
+size_t EncodeUtf8(uint32_t code, char* out);
+
+// Combining marks and joiners take no column of their own; they belong to
+// the character before them.
+bool IsCombining(uint32_t code);
+
+// East Asian wide and fullwidth characters, and emoji, take two columns.
+bool IsWide(uint32_t code);
+
+#endif  // TEXT_EDITOR_UTF8_H